@@ -0,0 +1,318 @@
+#define _GNU_SOURCE  // sched_setaffinity and sched_getcpu in sweep.h
+#include <mpi.h>
+#include <omp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "evolution.h"
+#include "sweep.h"
+
+// Correctness check of the evolution modes: known patterns and seeded random playgrounds are evolved
+// by every mode and every thread count of -T on the processes of the job, and compared after every
+// step with the serial update of main_vanilla_clean.c. The hashes of the playgrounds are compared,
+// on the first mismatch the playground is gathered and the first divergent cell is reported.
+// The patterns also have to come back to their initial state, which checks the reference itself.
+
+#define CHECK_SIZE 61        // prime, so the rows never split evenly between the processes
+#define CHECK_STEPS 40
+#define CHECK_SEEDS 3
+#define CHECK_RULES "B3/S23,B36/S23,B2/S/C3"
+#define RANDOMNESS 0.5
+#define NUM_MODES 2
+
+enum check_pattern { PATTERN_BLOCK, PATTERN_BLINKER, PATTERN_GLIDER, PATTERN_RANDOM };
+const char *pattern_names[] = {"block", "blinker", "glider", "random"};
+const char *mode_names[NUM_MODES] = {"ordered", "static"};
+
+void reference_step(int k, const unsigned char *playground, unsigned char *next, const struct rule *rule);
+int check_rule_table(const struct rule *rule, int rank);
+unsigned long playground_hash(int k, const unsigned char *playground, int start_row, int end_row);
+int row_owner(int k, int size, int row);
+int pattern_steps(int pattern, int k, int steps);
+void create_playground(int k, unsigned char *playground, int pattern, int seed, const struct rule *rule);
+int check_mode(int k, const unsigned char *initial, int steps, int mode, const struct rule *rule, bool periodic, const char *description, int rank, int size);
+
+int main(int argc, char **argv) {
+    int option;
+    int k = CHECK_SIZE, steps = CHECK_STEPS, seeds = CHECK_SEEDS, only_mode = -1;
+    char *thread_list = NULL;
+    const char *rule_list = CHECK_RULES;
+    static struct sweep_config configs[SWEEP_MAX_CONFIGS];
+    char rule_buffer[256], description[256];
+    int checks = 0, failures = 0;
+
+    MPI_Init(NULL, NULL);
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    while ((option = getopt(argc, argv, "k:n:s:e:b:T:")) != -1) {
+        switch (option) {
+            case 'k':  // Playground size
+                k = atoi(optarg);
+                break;
+            case 'n':  // Number of steps of the random playgrounds
+                steps = atoi(optarg);
+                break;
+            case 's':  // Number of random seeds per rule
+                seeds = atoi(optarg);
+                break;
+            case 'e':  // Check a single evolution type
+                only_mode = atoi(optarg);
+                break;
+            case 'b':  // Rules, e.g. B3/S23,B2/S/C3
+                rule_list = optarg;
+                break;
+            case 'T':  // Thread counts, e.g. 1-4
+                thread_list = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-k size] [-n steps] [-s seeds] [-e evolution_type] [-b rules] [-T threads]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    int num_configs = sweep_configs(thread_list, NULL, configs, SWEEP_MAX_CONFIGS);
+    if (num_configs < 0 || k < size || steps < 1 || seeds < 0 || only_mode >= NUM_MODES) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Missing or incorrect arguments provided, the size has to be at least the number of processes.\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    unsigned char *initial = (unsigned char *)malloc(k * k * sizeof(unsigned char));
+    if (initial == NULL) {
+        fprintf(stderr, "Error: Memory allocation for playground failed.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    strncpy(rule_buffer, rule_list, sizeof(rule_buffer) - 1);
+    rule_buffer[sizeof(rule_buffer) - 1] = '\0';
+    for (char *rule_string = strtok(rule_buffer, ","); rule_string != NULL; rule_string = strtok(NULL, ",")) {
+        struct rule rule;
+        if (parse_rule(rule_string, &rule) != 0) {
+            if (rank == 0) {
+                fprintf(stderr, "Error: Invalid rule %s, expected e.g. B3/S23 or B2/S/C3.\n", rule_string);
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        failures += check_rule_table(&rule, rank) != 0;
+
+        // The patterns are those of B3/S23, and need room to stay apart
+        int num_patterns = strcmp(rule.name, DEFAULT_RULE) == 0 && k >= 16 ? PATTERN_RANDOM : 0;
+        for (int test = 0; test < num_patterns + seeds; test++) {
+            int pattern = test < num_patterns ? test : PATTERN_RANDOM;
+            int seed = test - num_patterns + 1;
+            create_playground(k, initial, pattern, seed, &rule);
+            MPI_Bcast(initial, k * k, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+
+            for (int c = 0; c < num_configs; c++) {
+                omp_set_num_threads(configs[c].threads);
+                for (int mode = 0; mode < NUM_MODES; mode++) {
+                    if (only_mode >= 0 && mode != only_mode) {
+                        continue;
+                    }
+                    if (pattern == PATTERN_RANDOM) {
+                        snprintf(description, sizeof(description), "%s %s seed %d, %d processes, %d threads", mode_names[mode], rule.name, seed, size, configs[c].threads);
+                    } else {
+                        snprintf(description, sizeof(description), "%s %s %s, %d processes, %d threads", mode_names[mode], rule.name, pattern_names[pattern], size, configs[c].threads);
+                    }
+                    failures += check_mode(k, initial, pattern_steps(pattern, k, steps), mode, &rule, pattern != PATTERN_RANDOM, description, rank, size);
+                    checks++;
+                }
+            }
+        }
+    }
+
+    if (rank == 0) {
+        printf("%d of %d checks failed (size %d, %d processes)\n", failures, checks, k, size);
+    }
+    free(initial);
+    MPI_Finalize();
+    return failures > 0;
+}
+
+// The serial update of main_vanilla_clean.c, with the rule table in place of B3/S23
+void reference_step(int k, const unsigned char *playground, unsigned char *next, const struct rule *rule) {
+    for (int c_i = 0; c_i < k; c_i++) {
+        for (int c_j = 0; c_j < k; c_j++) {
+            int neighbors = 0;
+            for (int i = -1; i <= 1; i++) {
+                for (int j = -1; j <= 1; j++) {
+                    if (i == 0 && j == 0) continue;
+                    int n_i = (c_i + i + k) % k;
+                    int n_j = (c_j + j + k) % k;
+                    neighbors += playground[n_i * k + n_j] == 1;
+                }
+            }
+            next[c_i * k + c_j] = rule->table[playground[c_i * k + c_j] * 9 + neighbors];
+        }
+    }
+}
+
+// The table of B3/S23 has to agree with the births and survivals written out in main_vanilla_clean.c
+int check_rule_table(const struct rule *rule, int rank) {
+    int mismatches = 0;
+    if (strcmp(rule->name, DEFAULT_RULE) != 0) {
+        return 0;
+    }
+    for (int state = 0; state <= 1; state++) {
+        for (int neighbors = 0; neighbors <= 8; neighbors++) {
+            int expected = (state == 1 && (neighbors == 2 || neighbors == 3)) || (state == 0 && neighbors == 3);
+            if (rule->table[state * 9 + neighbors] != expected && rank == 0) {
+                printf("FAILED rule %s: state %d with %d neighbors gives %d, expected %d\n", rule->name, state, neighbors, rule->table[state * 9 + neighbors], expected);
+            }
+            mismatches += rule->table[state * 9 + neighbors] != expected;
+        }
+    }
+    return mismatches;
+}
+
+// Sum over the cells that are not dead, so that the hashes of the rows of different processes add up
+unsigned long playground_hash(int k, const unsigned char *playground, int start_row, int end_row) {
+    unsigned long hash = 0;
+    for (long index = (long)start_row * k; index < (long)end_row * k; index++) {
+        if (playground[index] != 0) {
+            hash += cell_hash(index * RULE_MAX_STATES + playground[index]);
+        }
+    }
+    return hash;
+}
+
+int row_owner(int k, int size, int row) {
+    int rows_per_proc = k / size;
+    int remainder = k % size;
+    for (int r = 0; r < size - 1; r++) {
+        if (row < (r + 1) * rows_per_proc + (r + 1 < remainder ? r + 1 : remainder)) {
+            return r;
+        }
+    }
+    return size - 1;
+}
+
+// Steps after which the pattern is back to its initial state: the glider crosses the whole playground
+int pattern_steps(int pattern, int k, int steps) {
+    switch (pattern) {
+        case PATTERN_BLINKER:
+            return steps + steps % 2;
+        case PATTERN_GLIDER:
+            return 4 * k;
+        default:
+            return steps;
+    }
+}
+
+// The patterns straddle the edges of the playground and the middle row, the boundary between two processes
+void create_playground(int k, unsigned char *playground, int pattern, int seed, const struct rule *rule) {
+    const int glider[5][2] = {{0, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}};
+    unsigned short state[3] = {(unsigned short)seed, (unsigned short)(seed >> 16), 0x330e};
+
+    memset(playground, 0, k * k * sizeof(unsigned char));
+    switch (pattern) {
+        case PATTERN_BLOCK:
+            for (int i = -1; i <= 0; i++) {
+                for (int j = -1; j <= 0; j++) {
+                    playground[((i + k) % k) * k + (j + k) % k] = 1;
+                    playground[(k / 2 + i) * k + k / 2 + j] = 1;
+                }
+            }
+            break;
+        case PATTERN_BLINKER:
+            for (int i = -1; i <= 1; i++) {
+                playground[((i + k) % k) * k + 3] = 1;
+                playground[(k / 2) * k + k / 2 + i] = 1;
+            }
+            break;
+        case PATTERN_GLIDER:
+            for (int c = 0; c < 5; c++) {
+                playground[((k - 2 + glider[c][0]) % k) * k + (k - 2 + glider[c][1]) % k] = 1;
+            }
+            break;
+        default:
+            // Dying states too for Generations rules
+            for (int i = 0; i < k * k; i++) {
+                if (erand48(state) < RANDOMNESS) {
+                    playground[i] = 1 + (int)(erand48(state) * (rule->states - 1));
+                }
+            }
+    }
+}
+
+// Evolve the playground with the given mode next to the reference, returns 1 on a divergence
+int check_mode(int k, const unsigned char *initial, int steps, int mode, const struct rule *rule, bool periodic, const char *description, int rank, int size) {
+    unsigned char *playground = (unsigned char *)malloc(k * k * sizeof(unsigned char));
+    unsigned char *reference = (unsigned char *)malloc(k * k * sizeof(unsigned char));
+    unsigned char *next = (unsigned char *)malloc(k * k * sizeof(unsigned char));
+    unsigned char *temp_playground = (unsigned char *)calloc(k * k, sizeof(unsigned char));
+    unsigned char *top_ghost_row = (unsigned char *)calloc(k, sizeof(unsigned char));
+    unsigned char *bottom_ghost_row = (unsigned char *)calloc(k, sizeof(unsigned char));
+    unsigned char *gathered_playground = NULL;
+    struct step_stats step_stats;
+    int diverged = 0, failed = 0;
+
+    int rows_per_proc = k / size;
+    int remainder = k % size;
+    int start_row = rank * rows_per_proc + (rank < remainder ? rank : remainder);
+    int end_row = start_row + rows_per_proc + (rank < remainder ? 1 : 0);
+
+    if (playground == NULL || reference == NULL || next == NULL || temp_playground == NULL || top_ghost_row == NULL || bottom_ghost_row == NULL) {
+        fprintf(stderr, "Error: Memory allocation for playground failed.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    memcpy(playground, initial, k * k * sizeof(unsigned char));
+    memcpy(reference, initial, k * k * sizeof(unsigned char));
+
+    // Every process keeps the reference, so all of them stop at the same step
+    for (int step = 0; step < steps && diverged == 0; step++) {
+        if (mode == 0) {
+            update_playground_ordered(k, playground, rank, size, temp_playground, top_ghost_row, bottom_ghost_row, rule, &step_stats);
+        } else {
+            update_playground_static(k, playground, rank, size, temp_playground, rule, &step_stats);
+        }
+        reference_step(k, reference, next, rule);
+        unsigned char *swap = reference;
+        reference = next;
+        next = swap;
+
+        unsigned long hash = playground_hash(k, playground, start_row, end_row);
+        MPI_Allreduce(MPI_IN_PLACE, &hash, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+        if (hash != playground_hash(k, reference, 0, k)) {
+            diverged = step + 1;
+        }
+    }
+
+    if (diverged > 0) {
+        if (rank == 0) {
+            gathered_playground = (unsigned char *)malloc(k * k * sizeof(unsigned char));
+        }
+        gather_playground(k, playground, gathered_playground, rank, size);
+        if (rank == 0) {
+            int cell = 0;
+            while (cell < k * k - 1 && gathered_playground[cell] == reference[cell]) {
+                cell++;
+            }
+            printf("FAILED %s: step %d, cell (%d, %d) of process %d is %d, expected %d\n", description, diverged, cell / k, cell % k,
+                   row_owner(k, size, cell / k), gathered_playground[cell], reference[cell]);
+            free(gathered_playground);
+        }
+        failed = 1;
+    } else if (periodic && memcmp(reference, initial, k * k * sizeof(unsigned char)) != 0) {
+        if (rank == 0) {
+            printf("FAILED %s: the reference is not back to the pattern after %d steps\n", description, steps);
+        }
+        failed = 1;
+    } else if (rank == 0) {
+        printf("ok     %s: %d steps, hash %016lx\n", description, steps, playground_hash(k, reference, 0, k));
+    }
+
+    free(playground);
+    free(reference);
+    free(next);
+    free(temp_playground);
+    free(top_ghost_row);
+    free(bottom_ghost_row);
+    return failed;
+}
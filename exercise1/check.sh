@@ -0,0 +1,13 @@
+#!/bin/bash
+# Correctness check of both evolution modes against the serial reference, small enough for a laptop:
+# 1 to 4 processes with 1 to 3 threads each. Extra arguments go to check.x, e.g. ./check.sh -k 100 -s 10
+
+make check || exit 1
+
+set -o pipefail
+status=0
+for processes in 1 2 3 4
+do
+	mpirun --oversubscribe -np $processes ./check.x -T 1-3 "$@" | grep -v "^ok" || status=1
+done
+exit $status
@@ -0,0 +1,213 @@
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHECKPOINT_MAGIC "GOLCKP3"  // version 2 records the rule, version 3 the length of the outputs
+#define CHECKPOINT_SLOTS 2  // slots are written in turn, so the previous checkpoint survives a crash during a write
+
+// The header is followed by k rows of (k + 7) / 8 bytes, one bit per cell, for two state rules
+// and by k rows of k bytes for rules with dying states.
+// A step of -1 marks a slot whose data region is being rewritten.
+// The frame stream and the statistics series are appended to as the run goes, their lengths at the step of
+// the checkpoint let a resumed run drop what was written after it (-1 when the run did not write them).
+struct checkpoint_header {
+    char magic[8];
+    int k;
+    int evolution_mode;
+    long step;
+    int states;
+    char rule[RULE_NAME_LENGTH];
+    long frames_length;
+    long stats_length;
+};
+
+struct checkpoint {
+    MPI_File file;
+    MPI_Request request;
+    unsigned char *buffer;       // packed rows of this rank, must stay untouched until the write completes
+    struct checkpoint_header header;
+    int pending;
+    int count;                   // checkpoints started so far, selects the slot
+};
+
+void checkpoint_filename(char *buffer, const char *dirname, const char *filename, int slot);
+int checkpoint_row_bytes(int k, int states);
+void pack_rows(const unsigned char *playground, unsigned char *packed, int k, int start_row, int end_row, int states);
+void unpack_rows(const unsigned char *packed, unsigned char *playground, int k, int start_row, int end_row, int states);
+void checkpoint_begin(struct checkpoint *ckpt, const char *dirname, const char *filename, unsigned char *playground, int k, int start_row, int end_row, long step, int evolution_mode, const struct rule *rule, long frames_length, long stats_length, int rank);
+void checkpoint_progress(struct checkpoint *ckpt);
+void checkpoint_finish(struct checkpoint *ckpt, int rank);
+long checkpoint_restore(const char *dirname, const char *filename, unsigned char **playground, int *k, int *evolution_mode, char *rule_name, long *frames_length, long *stats_length, int rank);
+
+void checkpoint_filename(char *buffer, const char *dirname, const char *filename, int slot) {
+    sprintf(buffer, "%s/%s_ckpt%d.bin", dirname, filename, slot);
+}
+
+int checkpoint_row_bytes(int k, int states) {
+    return states > 2 ? k : (k + 7) / 8;
+}
+
+void pack_rows(const unsigned char *playground, unsigned char *packed, int k, int start_row, int end_row, int states) {
+    int row_bytes = checkpoint_row_bytes(k, states);
+    if (states > 2) {
+        memcpy(packed, playground + start_row * k, (size_t)(end_row - start_row) * k);
+        return;
+    }
+    memset(packed, 0, (size_t)(end_row - start_row) * row_bytes);
+
+#pragma omp parallel for
+    for (int i = start_row; i < end_row; i++) {
+        unsigned char *row = packed + (size_t)(i - start_row) * row_bytes;
+        for (int j = 0; j < k; j++) {
+            row[j / 8] |= (playground[i * k + j] & 1) << (j % 8);
+        }
+    }
+}
+
+void unpack_rows(const unsigned char *packed, unsigned char *playground, int k, int start_row, int end_row, int states) {
+    int row_bytes = checkpoint_row_bytes(k, states);
+    if (states > 2) {
+        memcpy(playground + start_row * k, packed, (size_t)(end_row - start_row) * k);
+        return;
+    }
+
+#pragma omp parallel for
+    for (int i = start_row; i < end_row; i++) {
+        const unsigned char *row = packed + (size_t)(i - start_row) * row_bytes;
+        for (int j = 0; j < k; j++) {
+            playground[i * k + j] = (row[j / 8] >> (j % 8)) & 1;
+        }
+    }
+}
+
+// Start an asynchronous checkpoint of the rows owned by this rank.
+// The rows are packed into a private buffer, so the evolution can go on while the write is in flight.
+void checkpoint_begin(struct checkpoint *ckpt, const char *dirname, const char *filename, unsigned char *playground, int k, int start_row, int end_row, long step, int evolution_mode, const struct rule *rule, long frames_length, long stats_length, int rank) {
+    char filename_buffer[256];
+    int row_bytes = checkpoint_row_bytes(k, rule->states);
+
+    // Only one checkpoint can be in flight, as the buffer is reused
+    checkpoint_finish(ckpt, rank);
+
+    if (ckpt->buffer == NULL) {
+        ckpt->buffer = (unsigned char *)malloc((size_t)(end_row - start_row) * row_bytes + 1);
+        if (ckpt->buffer == NULL) {
+            fprintf(stderr, "Error: Memory allocation for checkpoint buffer failed.\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+
+    checkpoint_filename(filename_buffer, dirname, filename, ckpt->count % CHECKPOINT_SLOTS);
+    if (MPI_File_open(MPI_COMM_WORLD, filename_buffer, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &ckpt->file) != MPI_SUCCESS) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Unable to open checkpoint %s.\n", filename_buffer);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    memset(&ckpt->header, 0, sizeof(ckpt->header));
+    memcpy(ckpt->header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    ckpt->header.k = k;
+    ckpt->header.evolution_mode = evolution_mode;
+    ckpt->header.step = -1;
+    ckpt->header.states = rule->states;
+    strcpy(ckpt->header.rule, rule->name);
+    ckpt->header.frames_length = frames_length;
+    ckpt->header.stats_length = stats_length;
+
+    // Invalidate the slot before its data is overwritten
+    if (rank == 0) {
+        MPI_File_write_at(ckpt->file, 0, &ckpt->header, sizeof(ckpt->header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_sync(ckpt->file);
+    ckpt->header.step = step;
+
+    pack_rows(playground, ckpt->buffer, k, start_row, end_row, rule->states);
+    MPI_Offset offset = sizeof(struct checkpoint_header) + (MPI_Offset)start_row * row_bytes;
+    MPI_File_iwrite_at_all(ckpt->file, offset, ckpt->buffer, (end_row - start_row) * row_bytes, MPI_BYTE, &ckpt->request);
+
+    ckpt->pending = 1;
+    ckpt->count++;
+}
+
+// Let the MPI library advance the pending write between steps
+void checkpoint_progress(struct checkpoint *ckpt) {
+    int done;
+    if (ckpt->pending) {
+        MPI_Test(&ckpt->request, &done, MPI_STATUS_IGNORE);
+    }
+}
+
+// Wait for the pending write, then validate the slot by writing its step in the header
+void checkpoint_finish(struct checkpoint *ckpt, int rank) {
+    if (!ckpt->pending) {
+        return;
+    }
+
+    MPI_Wait(&ckpt->request, MPI_STATUS_IGNORE);
+    MPI_File_sync(ckpt->file);
+    if (rank == 0) {
+        MPI_File_write_at(ckpt->file, 0, &ckpt->header, sizeof(ckpt->header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&ckpt->file);
+    ckpt->pending = 0;
+}
+
+// Load the most recent valid checkpoint into a full k*k playground on every rank, with the rule it was run with
+// and the lengths of the frame stream and statistics series at its step.
+// The file holds the whole board, so the run can resume on any number of ranks.
+// Returns the step of the checkpoint, or -1 if no valid checkpoint was found.
+long checkpoint_restore(const char *dirname, const char *filename, unsigned char **playground, int *k, int *evolution_mode, char *rule_name, long *frames_length, long *stats_length, int rank) {
+    char filename_buffer[256];
+    struct checkpoint_header header, best;
+    int best_slot = -1;
+
+    if (rank == 0) {
+        for (int slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+            checkpoint_filename(filename_buffer, dirname, filename, slot);
+            FILE *file = fopen(filename_buffer, "rb");
+            if (file == NULL) {
+                continue;
+            }
+            if (fread(&header, sizeof(header), 1, file) == 1 &&
+                memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) == 0 &&
+                header.step >= 0 && (best_slot < 0 || header.step > best.step)) {
+                best = header;
+                best_slot = slot;
+            }
+            fclose(file);
+        }
+    }
+
+    MPI_Bcast(&best_slot, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (best_slot < 0) {
+        return -1;
+    }
+    MPI_Bcast(&best, sizeof(best), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    int row_bytes = checkpoint_row_bytes(best.k, best.states);
+    unsigned char *packed = (unsigned char *)malloc((size_t)best.k * row_bytes);
+    *playground = (unsigned char *)malloc((size_t)best.k * best.k * sizeof(unsigned char));
+    if (packed == NULL || *playground == NULL) {
+        fprintf(stderr, "Error: Memory allocation for checkpoint restore failed.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    MPI_File file;
+    checkpoint_filename(filename_buffer, dirname, filename, best_slot);
+    MPI_File_open(MPI_COMM_WORLD, filename_buffer, MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+    MPI_File_read_at_all(file, sizeof(struct checkpoint_header), packed, best.k * row_bytes, MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+
+    unpack_rows(packed, *playground, best.k, 0, best.k, best.states);
+    free(packed);
+
+    *k = best.k;
+    *evolution_mode = best.evolution_mode;
+    strcpy(rule_name, best.rule);
+    *frames_length = best.frames_length;
+    *stats_length = best.stats_length;
+    return best.step;
+}
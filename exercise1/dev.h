@@ -8,7 +8,9 @@ void append_to_logs(const char *log_filename, const char *filename, const char *
             printf("Failed to open or create logs.csv\n");
             return;
         }
-        // Use ftell to check if the file is empty (i.e., the current position is 0).
+        // Use ftell to check if the file is empty (i.e., the end is at position 0). The position of
+        // a file opened for appending is only moved to the end by the first write, so seek there first.
+        fseek(file, 0, SEEK_END);
         if (ftell(file) == 0) {
             fprintf(file, "file;program;mode;size;step;time_taken;info\n");  // The file is empty, so add the header line.
         }
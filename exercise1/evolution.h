@@ -1,6 +1,11 @@
 #include <mpi.h>
 #include <omp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rules.h"
+#include "stats.h"
 
 void print_playground(int k, unsigned char *playground, char *text) {
     printf("%s\n", text);
@@ -13,85 +18,132 @@ void print_playground(int k, unsigned char *playground, char *text) {
     printf("\n");
 }
 
+// Copy the rows start_row..end_row-1 of the new generation back to the playground.
+// The old and new states are both at hand here, so the step statistics come at no extra memory traffic.
+// stats is NULL when nothing reads them (no -a or -q), the rows are then only copied.
+void commit_rows(int k, unsigned char *playground, const unsigned char *temp_playground, int start_row, int end_row, struct step_stats *stats) {
+    if (stats == NULL) {
+        #pragma omp parallel for
+        for (int i = start_row; i < end_row; i++) {
+            memcpy(&playground[i * k], &temp_playground[i * k], k);
+        }
+        return;
+    }
+
+    int tile_rows = (end_row - start_row + STATS_TILE - 1) / STATS_TILE;
+    int tile_cols = (k + STATS_TILE - 1) / STATS_TILE;
+    unsigned long live = 0, births = 0, deaths = 0, changed_cells = 0, active_tiles = 0, hash = 0;
+
+    #pragma omp parallel for collapse(2) reduction(+ : live, births, deaths, changed_cells, active_tiles, hash)
+    for (int ti = 0; ti < tile_rows; ti++) {
+        for (int tj = 0; tj < tile_cols; tj++) {
+            int i_start = start_row + ti * STATS_TILE;
+            int i_end = i_start + STATS_TILE < end_row ? i_start + STATS_TILE : end_row;
+            int j_start = tj * STATS_TILE;
+            int j_end = j_start + STATS_TILE < k ? j_start + STATS_TILE : k;
+            unsigned long changed = 0;
+
+            for (int i = i_start; i < i_end; i++) {
+                for (int j = j_start; j < j_end; j++) {
+                    unsigned char old_cell = playground[i * k + j];
+                    unsigned char new_cell = temp_playground[i * k + j];
+                    live += new_cell == 1;
+                    births += old_cell != 1 && new_cell == 1;
+                    deaths += old_cell == 1 && new_cell != 1;
+                    changed |= old_cell != new_cell;
+                    changed_cells += old_cell != new_cell;
+                    hash += (new_cell != 0) * cell_hash(((unsigned long)i * k + j) * RULE_MAX_STATES + new_cell);
+                    playground[i * k + j] = new_cell;
+                }
+            }
+            active_tiles += changed;
+        }
+    }
+
+    stats->live = live;
+    stats->births = births;
+    stats->deaths = deaths;
+    stats->changed = changed_cells;
+    stats->active_tiles = active_tiles;
+    stats->tiles = (unsigned long)tile_rows * tile_cols;
+    stats->hash = hash;
+}
+
 ///////////////////////////////
 // ORDERED EVOLUTION
 
-unsigned char upgrade_cell_ordered(int c_i, int c_j, int k, unsigned char *playground, unsigned char *top_ghost_row, unsigned char *bottom_ghost_row) {
-    int n_i, n_j, neighbors = 0;
+// Rows start..end-1 are owned by this process, the rows just above and below them are the ghost rows.
+// Columns wrap around, rows wrap through the neighbours (the process itself when it is alone).
+unsigned char upgrade_cell_ordered(int c_i, int c_j, int k, int start, int end, unsigned char *playground, unsigned char *top_ghost_row, unsigned char *bottom_ghost_row, const struct rule *rule) {
+    int n_j, neighbors = 0;
     for (int i = -1; i <= 1; i++) {
+        const unsigned char *row;
+        if (c_i + i < start) {
+            row = top_ghost_row;
+        } else if (c_i + i >= end) {
+            row = bottom_ghost_row;
+        } else {
+            row = &playground[(c_i + i) * k];
+        }
         for (int j = -1; j <= 1; j++) {
             if (i == 0 && j == 0) continue;
-            n_i = (c_i + i + k) % k;
             n_j = (c_j + j + k) % k;
-            if (n_i == 0 && c_i == k - 1) {
-                neighbors += top_ghost_row[n_j];
-            } else if (n_i == k - 1 && c_i == 0) {
-                neighbors += bottom_ghost_row[n_j];
-            } else {
-                neighbors += playground[n_i * k + n_j];
-            }
+            neighbors += row[n_j] == 1;
         }
     }
 
     unsigned char current_state = playground[c_i * k + c_j];
 
-    if ((current_state == 1 && (neighbors == 2 || neighbors == 3)) ||
-        (current_state == 0 && neighbors == 3)) {
-        return 1;
-    } else {
-        return 0;
-    }
+    return rule->table[current_state * 9 + neighbors];
 }
 
-void update_playground_ordered(int k, unsigned char *playground, int rank, int num_procs, unsigned char *temp_playground, unsigned char *top_ghost_row, unsigned char *bottom_ghost_row) {
+void update_playground_ordered(int k, unsigned char *playground, int rank, int num_procs, unsigned char *temp_playground, unsigned char *top_ghost_row, unsigned char *bottom_ghost_row, const struct rule *rule, struct step_stats *stats) {
     int top_neighbor = (num_procs > 1) ? (rank - 1 + num_procs) % num_procs : 0;
     int bottom_neighbor = (num_procs > 1) ? (rank + 1) % num_procs : 0;
 
+    // Calculate the range of rows to be processed by the current process
+    int chunk_size = k / num_procs;
+    int remainder = k % num_procs;
+    int start = rank * chunk_size + ((rank < remainder) ? rank : remainder);
+    int end = start + chunk_size + (rank < remainder);
+
     MPI_Request request[4];
     MPI_Status status[4];
 
-    // Send top ghost row to previous process and receive from next process
-    MPI_Isend(&playground[0], k, MPI_UNSIGNED_CHAR, top_neighbor, 1, MPI_COMM_WORLD, &request[0]);
+    // Send the first owned row to the previous process and receive the bottom ghost row from the next one
+    MPI_Isend(&playground[start * k], k, MPI_UNSIGNED_CHAR, top_neighbor, 1, MPI_COMM_WORLD, &request[0]);
     MPI_Irecv(bottom_ghost_row, k, MPI_UNSIGNED_CHAR, bottom_neighbor, 1, MPI_COMM_WORLD, &request[1]);
-    MPI_Isend(&playground[(k - 1) * k], k, MPI_UNSIGNED_CHAR, bottom_neighbor, 0, MPI_COMM_WORLD, &request[2]);
+    MPI_Isend(&playground[(end - 1) * k], k, MPI_UNSIGNED_CHAR, bottom_neighbor, 0, MPI_COMM_WORLD, &request[2]);
     MPI_Irecv(top_ghost_row, k, MPI_UNSIGNED_CHAR, top_neighbor, 0, MPI_COMM_WORLD, &request[3]);
 
-    // Calculate the range of rows to be processed by the current process
-    int chunk_size = k / num_procs;
-    int remainder = k % num_procs;
-    int start = rank * chunk_size + ((rank < remainder) ? rank : remainder);
-    int end = start + chunk_size + (rank < remainder);
-    
     // Start computation that does not depend on the data being communicated
     #pragma omp parallel for collapse(2)
-    for (int i = start; i < end; i++) {
+    for (int i = start + 1; i < end - 1; i++) {
         for (int j = 0; j < k; j++) {
-            if (i != 0 && i != k - 1) {
-                temp_playground[i * k + j] = upgrade_cell_ordered(i, j, k, playground, top_ghost_row, bottom_ghost_row);
-            }
+            temp_playground[i * k + j] = upgrade_cell_ordered(i, j, k, start, end, playground, top_ghost_row, bottom_ghost_row, rule);
         }
     }
 
     // Wait for the communication to finish
     MPI_Waitall(4, request, status);
 
-    // Continue with the computation that depends on the data being communicated
-    #pragma omp parallel for collapse(2)
-    for (int i = 0; i < k; i++) {
-        for (int j = 0; j < k; j++) {
-            if (i == 0 || i == k - 1) {
-                temp_playground[i * k + j] = upgrade_cell_ordered(i, j, k, playground, top_ghost_row, bottom_ghost_row);
-            }
+    // Continue with the first and last owned rows, which depend on the ghost rows
+    #pragma omp parallel for
+    for (int j = 0; j < k; j++) {
+        temp_playground[start * k + j] = upgrade_cell_ordered(start, j, k, start, end, playground, top_ghost_row, bottom_ghost_row, rule);
+        if (end - 1 > start) {
+            temp_playground[(end - 1) * k + j] = upgrade_cell_ordered(end - 1, j, k, start, end, playground, top_ghost_row, bottom_ghost_row, rule);
         }
     }
 
-    memcpy(playground, temp_playground, k * k * sizeof(unsigned char));
+    // Only the owned rows are read back, the other rows are never read by this process
+    commit_rows(k, playground, temp_playground, start, end, stats);
 }
 
 ///////////////////////////////
 // STATIC EVOLUTION
 
-void update_cell_static(int i, int j, int k, unsigned char *playground, unsigned char *temp_playground) {
+void update_cell_static(int i, int j, int k, unsigned char *playground, unsigned char *temp_playground, const struct rule *rule) {
     int alive_neighbors = 0;
 
     for (int di = -1; di <= 1; di++) {
@@ -101,43 +153,35 @@ void update_cell_static(int i, int j, int k, unsigned char *playground, unsigned
             int ni = (i + di + k) % k;
             int nj = (j + dj + k) % k;
 
-            alive_neighbors += playground[ni * k + nj];
+            alive_neighbors += playground[ni * k + nj] == 1;
         }
     }
 
     int cell = playground[i * k + j];
-    if (cell == 1 && (alive_neighbors < 2 || alive_neighbors > 3)) {
-        temp_playground[i * k + j] = 0;
-    } else if (cell == 0 && alive_neighbors > 3) {
-        temp_playground[i * k + j] = 1;
-    } else {
-        temp_playground[i * k + j] = cell;
-    }
+    temp_playground[i * k + j] = rule->table[cell * 9 + alive_neighbors];
 }
 
-void update_playground_static(int k, unsigned char *playground, int rank, int num_procs, unsigned char *temp_playground) {
+void update_playground_static(int k, unsigned char *playground, int rank, int num_procs, unsigned char *temp_playground, const struct rule *rule, struct step_stats *stats) {
     int rows_per_proc = k / num_procs;
     int remainder = k % num_procs;
     int start_row = rank * rows_per_proc + (rank < remainder ? rank : remainder);
     int end_row = start_row + rows_per_proc + (rank < remainder ? 1 : 0);
 
+    int top_neighbor = (rank - 1 + num_procs) % num_procs;
+    int bottom_neighbor = (rank + 1) % num_procs;
     MPI_Request requests[4];
     int request_count = 0;
 
-    // Send top ghost row to previous process and receive from next process
-    if (rank > 0) {
-        MPI_Isend(playground + start_row * k, k, MPI_UNSIGNED_CHAR, rank - 1, 0, MPI_COMM_WORLD, &requests[request_count++]);
-    }
-    if (rank < num_procs - 1) {
-        MPI_Irecv(playground + end_row * k, k, MPI_UNSIGNED_CHAR, rank + 1, 0, MPI_COMM_WORLD, &requests[request_count++]);
-    }
+    // The rows wrap around: the first process exchanges its top row with the last one.
+    // A process alone already has both of its ghost rows.
+    if (num_procs > 1) {
+        // Send top ghost row to previous process and receive from next process
+        MPI_Isend(playground + start_row * k, k, MPI_UNSIGNED_CHAR, top_neighbor, 0, MPI_COMM_WORLD, &requests[request_count++]);
+        MPI_Irecv(playground + (end_row % k) * k, k, MPI_UNSIGNED_CHAR, bottom_neighbor, 0, MPI_COMM_WORLD, &requests[request_count++]);
 
-    // Send bottom ghost row to next process and receive from previous process
-    if (rank < num_procs - 1) {
-        MPI_Isend(playground + (end_row - 1) * k, k, MPI_UNSIGNED_CHAR, rank + 1, 0, MPI_COMM_WORLD, &requests[request_count++]);
-    }
-    if (rank > 0) {
-        MPI_Irecv(playground + (start_row - 1) * k, k, MPI_UNSIGNED_CHAR, rank - 1, 0, MPI_COMM_WORLD, &requests[request_count++]);
+        // Send bottom ghost row to next process and receive from previous process
+        MPI_Isend(playground + (end_row - 1) * k, k, MPI_UNSIGNED_CHAR, bottom_neighbor, 1, MPI_COMM_WORLD, &requests[request_count++]);
+        MPI_Irecv(playground + ((start_row - 1 + k) % k) * k, k, MPI_UNSIGNED_CHAR, top_neighbor, 1, MPI_COMM_WORLD, &requests[request_count++]);
     }
 
     MPI_Waitall(request_count, requests, MPI_STATUSES_IGNORE);
@@ -146,9 +190,37 @@ void update_playground_static(int k, unsigned char *playground, int rank, int nu
     #pragma omp parallel for collapse(2)
     for (int i = start_row; i < end_row; i++) {
         for (int j = 0; j < k; j++) {
-            update_cell_static(i, j, k, playground, temp_playground);
+            update_cell_static(i, j, k, playground, temp_playground, rule);
         }
     }
 
-    memcpy(playground, temp_playground, k * k * sizeof(unsigned char));
-}
\ No newline at end of file
+    // Only the owned rows are read back, ghost rows are received straight into the playground
+    commit_rows(k, playground, temp_playground, start_row, end_row, stats);
+}
+
+// Gather the rows owned by each process on rank 0, the row blocks differ in size when k % size != 0
+void gather_playground(int k, unsigned char *playground, unsigned char *gathered_playground, int rank, int size) {
+    int *recv_counts = NULL;
+    int *displs = NULL;
+    int rows_per_proc = k / size;
+    int remainder = k % size;
+    int start_row = rank * rows_per_proc + (rank < remainder ? rank : remainder);
+    int end_row = start_row + rows_per_proc + (rank < remainder ? 1 : 0);
+
+    if (rank == 0) {
+        recv_counts = (int *)malloc(size * sizeof(int));
+        displs = (int *)malloc(size * sizeof(int));
+        for (int r = 0; r < size; r++) {
+            int r_start = r * rows_per_proc + (r < remainder ? r : remainder);
+            recv_counts[r] = (rows_per_proc + (r < remainder ? 1 : 0)) * k;
+            displs[r] = r_start * k;
+        }
+    }
+
+    MPI_Gatherv(playground + start_row * k, (end_row - start_row) * k, MPI_UNSIGNED_CHAR, gathered_playground, recv_counts, displs, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        free(recv_counts);
+        free(displs);
+    }
+}
@@ -0,0 +1,107 @@
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Downsampled frames are appended to a single multi-image PGM file (one P5 image after the other),
+// which ffmpeg reads directly with -f pgm_pipe. Each pixel is the population density of a block x block
+// region of the playground; every process reduces its own rows, so only the small frame is communicated.
+struct frame_stream {
+    FILE *file;              // rank 0 only
+    int block;
+    int width, height;
+    int *counts;             // live cells per block in the rows of this process
+    int *totals;             // rank 0 only, reduced over all processes
+    unsigned char *pixels;   // rank 0 only
+};
+
+void open_frame_stream(struct frame_stream *frames, const char *dirname, const char *filename, int k, int block, long length, int rank);
+void write_frame(struct frame_stream *frames, const unsigned char *playground, int k, int start_row, int end_row, int rank);
+long frame_stream_length(struct frame_stream *frames);
+void close_frame_stream(struct frame_stream *frames, int rank);
+
+// A resumed run passes the length of the stream at its checkpoint: the frames after it are dropped and the
+// new ones appended. A length of -1 starts a new stream.
+void open_frame_stream(struct frame_stream *frames, const char *dirname, const char *filename, int k, int block, long length, int rank) {
+    char filename_buffer[256];
+
+    memset(frames, 0, sizeof(*frames));
+    frames->block = block;
+    frames->width = (k + block - 1) / block;
+    frames->height = (k + block - 1) / block;
+    frames->counts = (int *)calloc(frames->width * frames->height, sizeof(int));
+    if (frames->counts == NULL) {
+        fprintf(stderr, "Error: Memory allocation for frame buffer failed.\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    if (rank == 0) {
+        sprintf(filename_buffer, "%s/%s_frames.pgm", dirname, filename);
+        if (length >= 0 && truncate(filename_buffer, length) == 0) {
+            frames->file = fopen(filename_buffer, "ab");
+        } else {
+            frames->file = fopen(filename_buffer, "wb");
+        }
+        frames->totals = (int *)malloc(frames->width * frames->height * sizeof(int));
+        frames->pixels = (unsigned char *)malloc(frames->width * frames->height * sizeof(unsigned char));
+        if (frames->file == NULL || frames->totals == NULL || frames->pixels == NULL) {
+            fprintf(stderr, "Error: Unable to open frame stream %s.\n", filename_buffer);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+}
+
+void write_frame(struct frame_stream *frames, const unsigned char *playground, int k, int start_row, int end_row, int rank) {
+    int block = frames->block;
+    int width = frames->width;
+
+    memset(frames->counts, 0, frames->width * frames->height * sizeof(int));
+
+    // Each block row is reduced by a single thread, so the counts need no atomics
+#pragma omp parallel for schedule(static)
+    for (int block_row = start_row / block; block_row <= (end_row - 1) / block; block_row++) {
+        int first = block_row * block > start_row ? block_row * block : start_row;
+        int last = (block_row + 1) * block < end_row ? (block_row + 1) * block : end_row;
+        int *counts = frames->counts + block_row * width;
+        for (int i = first; i < last; i++) {
+            for (int j = 0; j < k; j++) {
+                counts[j / block] += playground[i * k + j] == 1;
+            }
+        }
+    }
+
+    MPI_Reduce(frames->counts, frames->totals, frames->width * frames->height, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        for (int bi = 0; bi < frames->height; bi++) {
+            int rows = (bi + 1) * block < k ? block : k - bi * block;
+            for (int bj = 0; bj < width; bj++) {
+                int cols = (bj + 1) * block < k ? block : k - bj * block;
+                frames->pixels[bi * width + bj] = (unsigned char)(255L * frames->totals[bi * width + bj] / ((long)rows * cols));
+            }
+        }
+        fprintf(frames->file, "P5\n%d %d\n255\n", width, frames->height);
+        fwrite(frames->pixels, 1, width * frames->height, frames->file);
+    }
+}
+
+// Bytes written so far, for the checkpoints; -1 on the ranks without the file
+long frame_stream_length(struct frame_stream *frames) {
+    if (frames->file == NULL) {
+        return -1;
+    }
+    fflush(frames->file);
+    return ftell(frames->file);
+}
+
+void close_frame_stream(struct frame_stream *frames, int rank) {
+    if (rank == 0 && frames->file != NULL) {
+        fclose(frames->file);
+    }
+    free(frames->counts);
+    free(frames->totals);
+    free(frames->pixels);
+    memset(frames, 0, sizeof(*frames));
+}
@@ -7,9 +7,17 @@ if [ -z "$1" ]; then
 fi
 
 name=$1
+scale=${2:-20} # upscale factor of each pixel
 index=1
 
 cd out.nosync
+
+# Frames streamed by main.x -v are already in a single multi-image PGM, ffmpeg reads it directly
+if [ -f "${name}_frames.pgm" ]; then
+  ffmpeg -r 30 -f pgm_pipe -i "${name}_frames.pgm" -vf "scale=iw*${scale}:ih*${scale}:flags=neighbor" -vcodec mpeg4 "$1.mp4" -y
+  exit 0
+fi
+
 mkdir converted
 
 for i in $name*.pgm; do
@@ -18,4 +26,4 @@ for i in $name*.pgm; do
   ((index++))
 done
 
-ffmpeg -r 30 -start_number 0 -i "converted/${name}_%d.jpeg" -vf "scale=iw*20:ih*20:flags=neighbor" -vcodec mpeg4 "$1.mp4" -y
\ No newline at end of file
+ffmpeg -r 30 -start_number 0 -i "converted/${name}_%d.jpeg" -vf "scale=iw*${scale}:ih*${scale}:flags=neighbor" -vcodec mpeg4 "$1.mp4" -y
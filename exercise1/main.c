@@ -1,3 +1,4 @@
+#define _GNU_SOURCE  // sched_setaffinity and sched_getcpu in sweep.h
 #include <mpi.h>
 #include <omp.h>
 #include <stdbool.h>
@@ -12,6 +13,10 @@
 #include "dev.h"
 #include "pgm.h"
 #include "evolution.h"
+#include "roofline.h"
+#include "checkpoint.h"
+#include "frames.h"
+#include "sweep.h"
 
 #define RANDOMNESS 0.5
 #define MAXVAL 255
@@ -19,24 +24,30 @@
 struct timeval start_time, end_time;
 
 void initialize_playground(int k, const char *filename, int rank);
-void run_playground(const char *filename, int steps, int evolution_mode, int save_step, int rank, int size, const char *info_string, const char *log_filename);
-void evolve_playground(int k, unsigned char *playground, int evolution_mode, int steps, int save_step, const char *filename, int rank, int size);
+void run_playground(const char *filename, int steps, int evolution_mode, int save_step, int checkpoint_step, int frame_block, bool stats, int stop_period, bool resume, const struct rule *rule, int rank, int size, const char *info_string, const char *log_filename, bool probe);
+void sweep_playground(const char *filename, const char *thread_list, const char *binding_list, int steps, int evolution_mode, const struct rule *rule, int rank, int size, const char *info_string, const char *log_filename, bool probe);
+void gather_cores(const char *local, char *cores, size_t length, int rank, int size);
+long evolve_playground(int k, unsigned char *playground, int evolution_mode, const struct rule *rule, long start_step, int steps, int save_step, int checkpoint_step, int frame_block, bool stats, int stop_period, const char *filename, long frames_length, long stats_length, int rank, int size);
 
 int main(int argc, char **argv) {
     int option;
-    bool initialize = false, run = false;
-    int evolution_type = 0, steps = 0, save_step = 0;
+    bool initialize = false, run = false, probe = false, resume = false, stats = false;
+    int evolution_type = 0, steps = 0, save_step = 0, checkpoint_step = 0, frame_block = 0, stop_period = 0;
     int k = 0;
     char *filename = NULL;
     char *info_string = NULL;
     char *log_filename = NULL;
+    char *thread_list = NULL;
+    char *binding_list = NULL;
+    const char *rule_string = DEFAULT_RULE;
+    struct rule rule;
 
     MPI_Init(NULL, NULL);
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    while ((option = getopt(argc, argv, "irk:e:f:n:s:t:l:")) != -1) {
+    while ((option = getopt(argc, argv, "irpxak:e:b:f:n:s:c:v:q:t:l:T:A:")) != -1) {
         switch (option) {
             case 'i':  // Initialize playground
                 initialize = true;
@@ -44,12 +55,18 @@ int main(int argc, char **argv) {
             case 'r':  // Run playground
                 run = true;
                 break;
+            case 'p':  // Probe memory bandwidth and compute peak for the roofline report
+                probe = true;
+                break;
             case 'k':  // Playground size
                 k = atoi(optarg);
                 break;
             case 'e':  // Evolution type
                 evolution_type = atoi(optarg);
                 break;
+            case 'b':  // Rule, e.g. B3/S23
+                rule_string = optarg;
+                break;
             case 'f':  // Filename
                 filename = optarg;
                 break;
@@ -59,25 +76,55 @@ int main(int argc, char **argv) {
             case 's':  // Save step
                 save_step = atoi(optarg);
                 break;
+            case 'c':  // Checkpoint step
+                checkpoint_step = atoi(optarg);
+                break;
+            case 'v':  // Stream downsampled frames instead of full snapshots
+                frame_block = atoi(optarg);
+                break;
+            case 'a':  // Write the per-step statistics time series
+                stats = true;
+                break;
+            case 'q':  // Stop when the playground repeats with a period up to this value
+                stop_period = atoi(optarg);
+                break;
+            case 'x':  // Resume from the latest checkpoint
+                resume = true;
+                break;
             case 't':  // Save a string for debugging purposes
                 info_string = optarg;
                 break;
             case 'l':  // Debugging option
                 log_filename = optarg;
                 break;
+            case 'T':  // Run once per thread count, e.g. 1-12 or 1,2,4-12:4
+                thread_list = optarg;
+                break;
+            case 'A':  // Run once per thread binding, close and/or spread
+                binding_list = optarg;
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-i] [-r] [-k size] [-e evolution_type] [-f filename] [-n steps] [-s save_step]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-i] [-r] [-k size] [-e evolution_type] [-b rule] [-f filename] [-n steps] [-s save_step] [-c checkpoint_step] [-v frame_block] [-a] [-q stop_period] [-x] [-p] [-T threads] [-A bindings]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
 
     // Perform the requested actions based on parsed arguments
-    printf("init: %i, k: %d, filename: %s, steps: %d, evolution_type: %d, save_step: %d\n", initialize, k, filename, steps, evolution_type, save_step);
+    printf("init: %i, k: %d, filename: %s, steps: %d, evolution_type: %d, save_step: %d, rule: %s\n", initialize, k, filename, steps, evolution_type, save_step, rule_string);
+
+    if (parse_rule(rule_string, &rule) != 0) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Invalid rule %s, expected e.g. B3/S23 or B2/S/C3.\n", rule_string);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
 
     if (initialize && filename != NULL && k > 0) {
         initialize_playground(k, filename, rank);
+    } else if (run && filename != NULL && steps > 0 && (evolution_type >= 0 && evolution_type <= 3) && (thread_list != NULL || binding_list != NULL)) {
+        sweep_playground(filename, thread_list, binding_list, steps, evolution_type, &rule, rank, size, info_string, log_filename, probe);
     } else if (run && filename != NULL && steps > 0 && (evolution_type >= 0 && evolution_type <= 3)) {
-        run_playground(filename, steps, evolution_type, save_step, rank, size, info_string, log_filename);
+        run_playground(filename, steps, evolution_type, save_step, checkpoint_step, frame_block, stats, stop_period, resume, &rule, rank, size, info_string, log_filename, probe);
     } else {
         if (rank == 0) {
             fprintf(stderr, "Error: Missing or incorrect arguments provided.\n");
@@ -118,8 +165,79 @@ void initialize_playground(int k, const char *filename, int rank) {
     }
 }
 
-void run_playground(const char *filename, int steps, int evolution_mode, int save_step, int rank, int size, const char *info_string, const char *log_filename) {
-    double time_elapsed;
+// One timed run per configuration, without snapshots, checkpoints or statistics so that only the
+// evolution is timed. The log line of each run gets the threads, the binding and the CPUs used.
+void sweep_playground(const char *filename, const char *thread_list, const char *binding_list, int steps, int evolution_mode, const struct rule *rule, int rank, int size, const char *info_string, const char *log_filename, bool probe) {
+    static struct sweep_config configs[SWEEP_MAX_CONFIGS];
+    static struct sweep_places places;
+    static char local[SWEEP_CORES_LENGTH], cores[SWEEP_CORES_LENGTH], sweep_info[SWEEP_CORES_LENGTH + 256];
+    int num_configs = sweep_configs(thread_list, binding_list, configs, SWEEP_MAX_CONFIGS);
+
+    if (num_configs < 0) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Invalid sweep -T %s -A %s, at most %d configurations.\n", thread_list != NULL ? thread_list : "-",
+                    binding_list != NULL ? binding_list : "-", SWEEP_MAX_CONFIGS);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (sweep_places_init(&places) != 0) {
+        fprintf(stderr, "Error: Unable to read the affinity of rank %d.\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    for (int c = 0; c < num_configs; c++) {
+        int counts[2];
+        counts[0] = sweep_pin(&places, configs[c].binding, configs[c].threads);
+        counts[1] = sweep_record(&places, configs[c].binding, local, sizeof(local));
+        MPI_Allreduce(MPI_IN_PLACE, counts, 2, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        gather_cores(local, cores, sizeof(cores), rank, size);
+        if (rank == 0) {
+            printf("Sweep %d/%d: %d threads, %s, CPUs %s\n", c + 1, num_configs, configs[c].threads, binding_names[configs[c].binding], cores);
+            if (counts[0] > 0 || counts[1] > 0) {
+                fprintf(stderr, "Warning: %d threads could not be pinned, %d run outside their core.\n", counts[0], counts[1]);
+            }
+        }
+        snprintf(sweep_info, sizeof(sweep_info), "%s%s-numthreads:%d -bind:%s -cores:%s", info_string != NULL ? info_string : "", info_string != NULL ? " " : "",
+                 configs[c].threads, binding_names[configs[c].binding], rank == 0 ? cores : "");
+        run_playground(filename, steps, evolution_mode, 0, 0, 0, false, 0, false, rule, rank, size, sweep_info, log_filename, probe);
+    }
+}
+
+// The CPU lists of sweep_record of every process, joined on rank 0 and separated by '/'
+void gather_cores(const char *local, char *cores, size_t length, int rank, int size) {
+    char *all = NULL;
+    size_t used = 0;
+
+    if (rank == 0) {
+        all = (char *)malloc((size_t)size * SWEEP_CORES_LENGTH);
+        if (all == NULL) {
+            fprintf(stderr, "Error: Memory allocation for the CPU lists failed.\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    MPI_Gather(local, SWEEP_CORES_LENGTH, MPI_CHAR, all, SWEEP_CORES_LENGTH, MPI_CHAR, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        cores[0] = '\0';
+        for (int r = 0; r < size; r++) {
+            int written = snprintf(cores + used, length - used, r == 0 ? "%s" : "/%s", all + (size_t)r * SWEEP_CORES_LENGTH);
+            if (written < 0 || (size_t)written >= length - used) {
+                break;
+            }
+            used += written;
+        }
+        free(all);
+    }
+}
+
+void run_playground(const char *filename, int steps, int evolution_mode, int save_step, int checkpoint_step, int frame_block, bool stats, int stop_period, bool resume, const struct rule *rule, int rank, int size, const char *info_string, const char *log_filename, bool probe) {
+    double time_elapsed, evolve_time;
+    long last_step;
+    struct roofline roof;
+
+    // Probe before the timed region, so it does not count in the logged time
+    if (probe) {
+        probe_roofline(&roof, evolution_mode, rule);
+    }
 
     if (rank == 0){
         gettimeofday(&start_time, NULL);
@@ -127,16 +245,44 @@ void run_playground(const char *filename, int steps, int evolution_mode, int sav
     
     unsigned char *playground = NULL;
     int k;
+    long start_step = -1, frames_length = -1, stats_length = -1;
     char filename_buffer[256];
-    sprintf(filename_buffer, "%s/%s.pgm", DIRNAME, filename);
-    read_generated_pgm_image(&playground, &k, filename_buffer);
+
+    if (resume) {
+        int checkpoint_mode;
+        char checkpoint_rule[RULE_NAME_LENGTH];
+        start_step = checkpoint_restore(DIRNAME, filename, &playground, &k, &checkpoint_mode, checkpoint_rule, &frames_length, &stats_length, rank);
+        if (start_step >= 0 && (checkpoint_mode != evolution_mode || strcmp(checkpoint_rule, rule->name) != 0)) {
+            if (rank == 0) {
+                fprintf(stderr, "Error: Checkpoint was written with evolution mode %d and rule %s.\n", checkpoint_mode, checkpoint_rule);
+            }
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (rank == 0) {
+            if (start_step >= 0) {
+                printf("Resuming from checkpoint at step %ld\n", start_step);
+            } else {
+                printf("No valid checkpoint found, starting from step 0\n");
+            }
+        }
+    }
+
+    if (start_step < 0) {
+        start_step = 0;
+        sprintf(filename_buffer, "%s/%s.pgm", DIRNAME, filename);
+        read_generated_pgm_image(&playground, &k, filename_buffer);
+    }
 
     if (playground == NULL) {
         fprintf(stderr, "Error: Memory allocation for playground failed.\n");
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
-    evolve_playground(k, playground, evolution_mode, steps, save_step, filename, rank, size);
+    MPI_Barrier(MPI_COMM_WORLD);
+    evolve_time = MPI_Wtime();
+    last_step = evolve_playground(k, playground, evolution_mode, rule, start_step, steps, save_step, checkpoint_step, frame_block, stats, stop_period, filename, frames_length, stats_length, rank, size);
+    MPI_Barrier(MPI_COMM_WORLD);
+    evolve_time = MPI_Wtime() - evolve_time;
 
     if (playground != NULL) {
         free(playground);
@@ -146,13 +292,22 @@ void run_playground(const char *filename, int steps, int evolution_mode, int sav
         gettimeofday(&end_time, NULL);
         time_elapsed = (end_time.tv_sec - start_time.tv_sec) + (end_time.tv_usec - start_time.tv_usec) / 1e6;
         printf("Time taken: %f seconds\n", time_elapsed);
+        if (probe) {
+            print_roofline(&roof, evolution_mode, k, last_step - start_step, size, evolve_time);
+        }
         sprintf(filename_buffer, "mpi_openmp");
         append_to_logs(log_filename, filename, filename_buffer, evolution_mode, time_elapsed, k, steps, info_string);
     }
 }
 
-void evolve_playground(int k, unsigned char *playground, int evolution_mode, int steps, int save_step, const char *filename, int rank, int size) {
+long evolve_playground(int k, unsigned char *playground, int evolution_mode, const struct rule *rule, long start_step, int steps, int save_step, int checkpoint_step, int frame_block, bool stats, int stop_period, const char *filename, long frames_length, long stats_length, int rank, int size) {
     char filename_buffer[256];
+    struct checkpoint ckpt = {0};
+    struct frame_stream frames = {0};
+    struct step_stats step_stats;
+    struct step_stats *step_stats_out = stats || stop_period > 0 ? &step_stats : NULL;
+    struct stats_series series = {0};
+    long step;
     unsigned char *temp_playground = NULL;
     unsigned char *top_ghost_row = NULL;
     unsigned char *bottom_ghost_row = NULL;
@@ -161,20 +316,37 @@ void evolve_playground(int k, unsigned char *playground, int evolution_mode, int
     if (evolution_mode == 0){
         // Allocate memory for ordered evolution
         temp_playground = (unsigned char *)calloc(k * k, sizeof(unsigned char));
-        top_ghost_row = (unsigned char *)calloc(k * k, sizeof(unsigned char));
-        bottom_ghost_row = (unsigned char *)calloc(k * k, sizeof(unsigned char));
+        top_ghost_row = (unsigned char *)calloc(k, sizeof(unsigned char));
+        bottom_ghost_row = (unsigned char *)calloc(k, sizeof(unsigned char));
     } else if (evolution_mode == 1) {
         // Allocate memory for static evolution
         temp_playground = (unsigned char *)calloc(k * k, sizeof(unsigned char));
     }
     
-    for (int step = 0; step < steps; step++) {
+    // Calculate the rows owned by this process
+    int rows_per_proc = k / size;
+    int remainder = k % size;
+    int start_row = rank * rows_per_proc + (rank < remainder ? rank : remainder);
+    int end_row = start_row + rows_per_proc + (rank < remainder ? 1 : 0);
+
+    // Full snapshots are gathered on rank 0, downsampled frames are reduced instead
+    if (frame_block > 0 && save_step > 0) {
+        open_frame_stream(&frames, DIRNAME, filename, k, frame_block, frames_length, rank);
+    } else if (rank == 0) {
+        gathered_playground = (unsigned char *)calloc(k * k, sizeof(unsigned char));
+    }
+
+    if (stats) {
+        open_stats_series(&series, DIRNAME, filename, stats_length, rank);
+    }
+
+    for (step = start_step; step < steps; step++) {
         switch (evolution_mode) {
             case 0:
-                update_playground_ordered(k, playground, rank, size, temp_playground, top_ghost_row, bottom_ghost_row);
+                update_playground_ordered(k, playground, rank, size, temp_playground, top_ghost_row, bottom_ghost_row, rule, step_stats_out);
                 break;
             case 1:
-                update_playground_static(k, playground, rank, size, temp_playground);
+                update_playground_static(k, playground, rank, size, temp_playground, rule, step_stats_out);
                 break;
             // case 2:
             //     update_playground_random_start(k, playground, rank, size);
@@ -189,36 +361,57 @@ void evolve_playground(int k, unsigned char *playground, int evolution_mode, int
                 MPI_Abort(MPI_COMM_WORLD, 1);
         }
 
-        
-        // Gather playground from all processes
-        if (rank == 0) {
-            gathered_playground = (unsigned char *)calloc(k * k, sizeof(unsigned char));
+        // Combine the statistics of all processes and stop early once the playground has stabilised
+        int stopping = 0;
+        if (stats || stop_period > 0) {
+            reduce_step_stats(&step_stats);
+            write_step_stats(&series, &step_stats, step + 1, rank);
+            int period = stop_period > 0 ? detect_period(&series, &step_stats, step + 1, stop_period) : 0;
+            if (period > 0) {
+                if (rank == 0) {
+                    printf("Stopping at step %ld: the playground repeats with period %d\n", step + 1, period);
+                }
+                stopping = 1;
+            }
         }
 
-        // Calculate the number of rows that each process is updating
-        int rows_per_proc = k / size;
-        int remainder = k % size;
-        int start_row = rank * rows_per_proc + (rank < remainder ? rank : remainder);
-        int end_row = start_row + rows_per_proc + (rank < remainder ? 1 : 0);
-
-        // Calculate the number of cells that each process is updating
-        int num_cells = (end_row - start_row) * k;
+        // Save a frame or a full snapshot of the playground, the last step of an early stop included
+        if (save_step > 0 && ((step + 1) % save_step == 0 || stopping)) {
+            if (frames.block > 0) {
+                write_frame(&frames, playground, k, start_row, end_row, rank);
+            } else {
+                gather_playground(k, playground, gathered_playground, rank, size);
+                if (rank == 0) {
+                    sprintf(filename_buffer, "%s/%s_%05ld.pgm", DIRNAME, filename, step + 1);
+                    generate_pgm_image(gathered_playground, MAXVAL, k, filename_buffer);
+                }
+            }
+        }
 
-        // Gather the updated portions of the playground from each process
-        MPI_Gather(playground + start_row * k, num_cells, MPI_UNSIGNED_CHAR, gathered_playground, num_cells, MPI_UNSIGNED_CHAR, 0, MPI_COMM_WORLD);
+        // Checkpoint the owned rows, the write overlaps with the next steps
+        if (checkpoint_step > 0 && ((step + 1) % checkpoint_step == 0 || stopping)) {
+            checkpoint_begin(&ckpt, DIRNAME, filename, playground, k, start_row, end_row, step + 1, evolution_mode, rule, frame_stream_length(&frames), stats_series_length(&series), rank);
+        } else {
+            checkpoint_progress(&ckpt);
+        }
 
-        // Print playground
-        if (save_step > 0 && (step + 1) % save_step == 0) {
-            if (rank == 0) {
-                sprintf(filename_buffer, "%s/%s_%05d.pgm", DIRNAME, filename, step + 1);
-                generate_pgm_image(gathered_playground, MAXVAL, k, filename_buffer);  // Use gathered_playground here
-            }
+        if (stopping) {
+            step++;
+            break;
         }
     }
 
-    if (save_step == 0 && rank == 0) {
-        sprintf(filename_buffer, "%s/%s_final.pgm", DIRNAME, filename);
-        generate_pgm_image(gathered_playground, MAXVAL, k, filename_buffer);  // Use gathered_playground here
+    checkpoint_finish(&ckpt, rank);
+    free(ckpt.buffer);
+    close_frame_stream(&frames, rank);
+    close_stats_series(&series, rank);
+
+    if (save_step == 0) {
+        gather_playground(k, playground, gathered_playground, rank, size);
+        if (rank == 0) {
+            sprintf(filename_buffer, "%s/%s_final.pgm", DIRNAME, filename);
+            generate_pgm_image(gathered_playground, MAXVAL, k, filename_buffer);
+        }
     }
 
     // Free memory for ordered evolution
@@ -234,4 +427,6 @@ void evolve_playground(int k, unsigned char *playground, int evolution_mode, int
     if (rank == 0 && gathered_playground != NULL) {
         free(gathered_playground);
     }
-}
\ No newline at end of file
+
+    return step;
+}
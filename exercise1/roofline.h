@@ -0,0 +1,145 @@
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STREAM_ARRAY_SIZE (1 << 23)  // doubles per array, large enough to spill out of the last level cache
+#define STREAM_NTIMES 5              // the best of the repetitions is kept, as in STREAM
+#define PEAK_BOARD_SIZE 96           // board side for the cache resident probe (two boards fit in L1/L2)
+#define PEAK_STEPS 50
+
+struct roofline {
+    double bandwidth;     // measured memory bandwidth, bytes per second (sum over all ranks)
+    double peak_updates;  // measured cache resident update rate, cells per second (sum over all ranks)
+};
+
+double measure_stream_bandwidth();
+double measure_peak_updates(int evolution_mode, const struct rule *rule);
+void probe_roofline(struct roofline *roof, int evolution_mode, const struct rule *rule);
+double bytes_per_update(int evolution_mode);
+void print_roofline(const struct roofline *roof, int evolution_mode, int k, int steps, int size, double evolve_time);
+
+// STREAM-like triad a = b + s*c, run by all the threads of the rank.
+// It counts 3 doubles of traffic per element (the write-allocate of a is not counted, as in STREAM).
+double measure_stream_bandwidth() {
+    double *a = (double *)malloc(STREAM_ARRAY_SIZE * sizeof(double));
+    double *b = (double *)malloc(STREAM_ARRAY_SIZE * sizeof(double));
+    double *c = (double *)malloc(STREAM_ARRAY_SIZE * sizeof(double));
+    if (a == NULL || b == NULL || c == NULL) {
+        free(a);
+        free(b);
+        free(c);
+        return 0.0;
+    }
+
+    // First touch with the same schedule as the triad, so pages are placed near the threads using them
+#pragma omp parallel for schedule(static)
+    for (long i = 0; i < STREAM_ARRAY_SIZE; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    double best = 0.0;
+    for (int t = 0; t < STREAM_NTIMES; t++) {
+        double start = omp_get_wtime();
+#pragma omp parallel for schedule(static)
+        for (long i = 0; i < STREAM_ARRAY_SIZE; i++) {
+            a[i] = b[i] + 3.0 * c[i];
+        }
+        double elapsed = omp_get_wtime() - start;
+        if (elapsed > 0 && best < 1.0 / elapsed) {
+            best = 1.0 / elapsed;
+        }
+    }
+
+    // Keep the compiler from dropping the triad
+    if (a[STREAM_ARRAY_SIZE / 2] != 7.0) {
+        fprintf(stderr, "Warning: STREAM probe returned a wrong result.\n");
+    }
+
+    free(a);
+    free(b);
+    free(c);
+    return best * 3.0 * sizeof(double) * STREAM_ARRAY_SIZE;
+}
+
+// Run the kernel of the given evolution mode on a small private board per thread.
+// The board stays in cache, so the rate measured is the compute ceiling of the kernel.
+double measure_peak_updates(int evolution_mode, const struct rule *rule) {
+    const int k = PEAK_BOARD_SIZE;
+    long updates = 0;
+    double start = omp_get_wtime();
+
+#pragma omp parallel reduction(+ : updates)
+    {
+        unsigned char *board = (unsigned char *)calloc(k * k, sizeof(unsigned char));
+        unsigned char *temp = (unsigned char *)calloc(k * k, sizeof(unsigned char));
+        unsigned int seed = 1234 + omp_get_thread_num();
+        if (board != NULL && temp != NULL) {
+            for (int i = 0; i < k * k; i++) {
+                board[i] = rand_r(&seed) % rule->states;
+            }
+            for (int step = 0; step < PEAK_STEPS; step++) {
+                for (int i = 0; i < k; i++) {
+                    for (int j = 0; j < k; j++) {
+                        if (evolution_mode == 0) {
+                            temp[i * k + j] = upgrade_cell_ordered(i, j, k, 0, k, board, &board[(k - 1) * k], &board[0], rule);
+                        } else {
+                            update_cell_static(i, j, k, board, temp, rule);
+                        }
+                    }
+                }
+                unsigned char *swap = board;
+                board = temp;
+                temp = swap;
+            }
+            updates += (long)PEAK_STEPS * k * k;
+        }
+        free(board);
+        free(temp);
+    }
+
+    double elapsed = omp_get_wtime() - start;
+    return elapsed > 0 ? updates / elapsed : 0.0;
+}
+
+// Every rank probes at the same time, so the bandwidth shared by ranks on a node is measured under contention.
+void probe_roofline(struct roofline *roof, int evolution_mode, const struct rule *rule) {
+    double local[2], global[2];
+    local[0] = measure_stream_bandwidth();
+    local[1] = measure_peak_updates(evolution_mode, rule);
+    MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    roof->bandwidth = global[0];
+    roof->peak_updates = global[1];
+}
+
+// Memory traffic per cell update of one step, summed over all ranks.
+// Each update reads the cell once (neighbours are reused from cache) and writes it to temp_playground
+// (one byte plus the write-allocate). The owned rows are then committed back to the playground, reading
+// both boards and writing the playground (3 bytes). Both modes only exchange two k-cell ghost rows per
+// rank, negligible next to the rows they own.
+double bytes_per_update(int evolution_mode) {
+    switch (evolution_mode) {
+        case 0:
+        case 1:
+            return 6.0;
+        default:
+            return 0.0;
+    }
+}
+
+void print_roofline(const struct roofline *roof, int evolution_mode, int k, int steps, int size, double evolve_time) {
+    double updates = (double)k * k * steps;
+    double bytes = bytes_per_update(evolution_mode);
+    double achieved = evolve_time > 0 ? updates / evolve_time : 0.0;
+    double memory_bound = bytes > 0 ? roof->bandwidth / bytes : 0.0;
+    double bound = memory_bound < roof->peak_updates ? memory_bound : roof->peak_updates;
+
+    printf("Evolution time: %f seconds, %e updates/s (%e per rank)\n", evolve_time, achieved, achieved / size);
+    printf("Bytes per update: %.1f, achieved bandwidth: %.2f GB/s of %.2f GB/s measured (%.1f%%)\n",
+           bytes, achieved * bytes * 1e-9, roof->bandwidth * 1e-9, roof->bandwidth > 0 ? 100.0 * achieved * bytes / roof->bandwidth : 0.0);
+    printf("Compute peak: %e updates/s, memory bound: %e updates/s -> %s bound\n",
+           roof->peak_updates, memory_bound, memory_bound < roof->peak_updates ? "memory" : "compute");
+    printf("Roofline: %e updates/s attainable, %.1f%% reached\n", bound, bound > 0 ? 100.0 * achieved / bound : 0.0);
+}
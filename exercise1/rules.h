@@ -0,0 +1,74 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RULE_MAX_STATES 32
+#define RULE_NAME_LENGTH 32
+#define DEFAULT_RULE "B3/S23"
+
+// Outer totalistic rule compiled into a lookup table: the next state of a cell is
+// table[state * 9 + live_neighbours], so the kernels never branch on the rule.
+// Life-like rules (B3/S23, B36/S23, ...) have 2 states. Generations rules (B2/S/C3, ...) add
+// dying states 2..states-1: a live cell that does not survive starts dying, a dying cell ages by
+// one each step and turns dead after the last state. Only cells in state 1 count as neighbours.
+struct rule {
+    char name[RULE_NAME_LENGTH];
+    int states;
+    unsigned char table[RULE_MAX_STATES * 9];
+};
+
+int parse_rule(const char *rule_string, struct rule *rule);
+
+// Accept "B3/S23", "S23/B3", lower case letters and an optional "/C<states>" (or "/<states>") part.
+// Returns 0 on success, -1 if the string is not a valid rule.
+int parse_rule(const char *rule_string, struct rule *rule) {
+    int birth[9] = {0}, survival[9] = {0};
+    int seen_birth = 0, seen_survival = 0;
+    int *target = NULL;
+    const char *c;
+
+    if (strlen(rule_string) >= RULE_NAME_LENGTH) {
+        return -1;
+    }
+    memset(rule, 0, sizeof(*rule));
+    strcpy(rule->name, rule_string);
+    rule->states = 2;
+
+    for (c = rule_string; *c != '\0'; c++) {
+        char upper = toupper((unsigned char)*c);
+        if (upper == 'B') {
+            target = birth;
+            seen_birth = 1;
+        } else if (upper == 'S') {
+            target = survival;
+            seen_survival = 1;
+        } else if (upper == 'C' || (target == NULL && isdigit((unsigned char)*c))) {
+            // Number of states, it has to come after both the B and S parts
+            if (!seen_birth || !seen_survival) {
+                return -1;
+            }
+            rule->states = atoi(upper == 'C' ? c + 1 : c);
+            break;
+        } else if (*c == '/') {
+            target = NULL;
+        } else if (isdigit((unsigned char)*c) && *c != '9') {
+            target[*c - '0'] = 1;
+        } else {
+            return -1;
+        }
+    }
+
+    if (!seen_birth || !seen_survival || rule->states < 2 || rule->states > RULE_MAX_STATES) {
+        return -1;
+    }
+
+    for (int n = 0; n <= 8; n++) {
+        rule->table[0 * 9 + n] = birth[n];
+        rule->table[1 * 9 + n] = survival[n] ? 1 : (rule->states > 2 ? 2 : 0);
+        for (int state = 2; state < rule->states; state++) {
+            rule->table[state * 9 + n] = (state + 1) % rule->states;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STATS_TILE 64      // side of the tiles counted by the active tile fraction
+#define STATS_HISTORY 16   // longest period that can be detected
+
+// Statistics of one step, accumulated while the new generation is written back to the playground.
+// The hash is a sum over the cells that are not dead (with their state, dying states included),
+// so partial hashes of different processes simply add up.
+struct step_stats {
+    unsigned long live;
+    unsigned long births;
+    unsigned long deaths;
+    unsigned long changed;   // cells whose state changed, dying cells that age included
+    unsigned long active_tiles;
+    unsigned long tiles;
+    unsigned long hash;
+};
+
+struct stats_series {
+    FILE *file;                             // rank 0 only
+    unsigned long history[STATS_HISTORY];   // hashes of the previous steps, indexed by step % STATS_HISTORY
+    int recorded;
+};
+
+unsigned long cell_hash(unsigned long index);
+void open_stats_series(struct stats_series *series, const char *dirname, const char *filename, long length, int rank);
+void reduce_step_stats(struct step_stats *stats);
+int detect_period(struct stats_series *series, const struct step_stats *stats, long step, int max_period);
+void write_step_stats(struct stats_series *series, const struct step_stats *stats, long step, int rank);
+long stats_series_length(struct stats_series *series);
+void close_stats_series(struct stats_series *series, int rank);
+
+// 64 bit mix of the cell index (the splitmix64 finalizer)
+unsigned long cell_hash(unsigned long index) {
+    index = (index ^ (index >> 30)) * 0xbf58476d1ce4e5b9UL;
+    index = (index ^ (index >> 27)) * 0x94d049bb133111ebUL;
+    return index ^ (index >> 31);
+}
+
+// As for the frame stream, a resumed run drops the rows after its checkpoint (length -1 starts a new series)
+void open_stats_series(struct stats_series *series, const char *dirname, const char *filename, long length, int rank) {
+    char filename_buffer[256];
+
+    memset(series, 0, sizeof(*series));
+    if (rank == 0) {
+        sprintf(filename_buffer, "%s/%s_stats.csv", dirname, filename);
+        if (length >= 0 && truncate(filename_buffer, length) == 0) {
+            series->file = fopen(filename_buffer, "a");
+        } else {
+            series->file = fopen(filename_buffer, "w");
+        }
+        if (series->file == NULL) {
+            fprintf(stderr, "Error: Unable to open %s.\n", filename_buffer);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        if (ftell(series->file) == 0) {
+            fprintf(series->file, "step,live,births,deaths,active_tiles\n");
+        }
+    }
+}
+
+// A single reduction over all the counters, every rank gets the totals so all of them can stop together
+void reduce_step_stats(struct step_stats *stats) {
+    MPI_Allreduce(MPI_IN_PLACE, stats, sizeof(*stats) / sizeof(unsigned long), MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+}
+
+// Return the period (1 for a still life) if the board repeats one of the last max_period states, 0 otherwise.
+// A still life is exact (no cell changed state), longer periods rely on the hash.
+int detect_period(struct stats_series *series, const struct step_stats *stats, long step, int max_period) {
+    int period = 0;
+
+    if (stats->changed == 0) {
+        period = 1;
+    } else {
+        for (int p = 2; p <= max_period && p <= series->recorded && p <= STATS_HISTORY; p++) {
+            if (series->history[(step - p + STATS_HISTORY) % STATS_HISTORY] == stats->hash) {
+                period = p;
+                break;
+            }
+        }
+    }
+
+    series->history[step % STATS_HISTORY] = stats->hash;
+    series->recorded++;
+    return period;
+}
+
+void write_step_stats(struct stats_series *series, const struct step_stats *stats, long step, int rank) {
+    if (rank == 0 && series->file != NULL) {
+        fprintf(series->file, "%ld,%lu,%lu,%lu,%.4f\n", step, stats->live, stats->births, stats->deaths,
+                stats->tiles > 0 ? (double)stats->active_tiles / stats->tiles : 0.0);
+    }
+}
+
+// Bytes written so far, for the checkpoints; -1 on the ranks without the file
+long stats_series_length(struct stats_series *series) {
+    if (series->file == NULL) {
+        return -1;
+    }
+    fflush(series->file);
+    return ftell(series->file);
+}
+
+void close_stats_series(struct stats_series *series, int rank) {
+    if (rank == 0 && series->file != NULL) {
+        fclose(series->file);
+    }
+    memset(series, 0, sizeof(*series));
+}
@@ -0,0 +1,230 @@
+#include <omp.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// In-process sweep over thread counts (-T 1,2,4-64:4) and binding policies (-A close,spread).
+// The places are the physical cores the process may run on (its affinity at startup, as left by
+// mpirun or taskset, SMT siblings grouped through sysfs), in the order of their first CPU. For T threads
+//   close   thread t runs on place t
+//   spread  thread t runs on place t * places / T
+// and every thread of the OpenMP team pins itself with sched_setaffinity, which overrides
+// OMP_PROC_BIND. After pinning, every thread reports the CPU it runs on (sched_getcpu): the CPUs go
+// to the results and threads found outside their place are counted.
+// exercise1/sweep.h and exercise2/sweep.h are the same file, keep them identical: each exercise is
+// built and submitted from its own directory, which is all its Makefile and job scripts see.
+
+#define SWEEP_MAX_THREADS 1024
+#define SWEEP_MAX_CONFIGS 512
+#define SWEEP_CORES_LENGTH 8192
+
+enum sweep_binding { BIND_CLOSE, BIND_SPREAD, NUM_BINDINGS };
+const char *binding_names[NUM_BINDINGS] = {"close", "spread"};
+
+struct sweep_config {
+    int threads;
+    int binding;
+};
+
+struct sweep_places {
+    int count;
+    cpu_set_t cores[SWEEP_MAX_THREADS];
+};
+
+int parse_thread_list(const char *list, int *threads, int max);
+int parse_bindings(const char *list, int *bindings);
+int sweep_configs(const char *thread_list, const char *binding_list, struct sweep_config *configs, int max);
+void parse_cpu_list(const char *list, cpu_set_t *set);
+int sweep_places_init(struct sweep_places *places);
+int sweep_place(const struct sweep_places *places, int binding, int thread, int threads);
+int sweep_pin(const struct sweep_places *places, int binding, int threads);
+int sweep_record(const struct sweep_places *places, int binding, char *buffer, size_t size);
+void sweep_label(char *buffer, size_t size, const char *label, int threads);
+
+// Comma separated counts and ranges first-last[:step]. Returns the number of counts, -1 on an error
+int parse_thread_list(const char *list, int *threads, int max) {
+    char buffer[256];
+    int count = 0;
+
+    strncpy(buffer, list, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    for (char *item = strtok(buffer, ","); item != NULL; item = strtok(NULL, ",")) {
+        int first, last, step = 1;
+        int fields = sscanf(item, "%d-%d:%d", &first, &last, &step);
+        if (fields == 1) {
+            last = first;
+        }
+        if (fields < 1 || first < 1 || last < first || step < 1 || last > SWEEP_MAX_THREADS) {
+            return -1;
+        }
+        for (int t = first; t <= last; t += step) {
+            if (count == max) {
+                return -1;
+            }
+            threads[count++] = t;
+        }
+    }
+    return count;
+}
+
+// Returns the number of policies parsed, -1 on an unknown name
+int parse_bindings(const char *list, int *bindings) {
+    char buffer[256];
+    int count = 0;
+
+    strncpy(buffer, list, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    for (char *name = strtok(buffer, ","); name != NULL; name = strtok(NULL, ",")) {
+        int found = -1;
+        for (int b = 0; b < NUM_BINDINGS; b++) {
+            if (strcmp(name, binding_names[b]) == 0) {
+                found = b;
+            }
+        }
+        if (found < 0 || count == NUM_BINDINGS) {
+            return -1;
+        }
+        bindings[count++] = found;
+    }
+    return count;
+}
+
+// Every binding with every thread count, bindings outermost. A missing list stands for the
+// current number of threads or for close. Returns the number of configurations, -1 on an error
+int sweep_configs(const char *thread_list, const char *binding_list, struct sweep_config *configs, int max) {
+    int threads[SWEEP_MAX_CONFIGS] = {omp_get_max_threads()}, bindings[NUM_BINDINGS] = {BIND_CLOSE};
+    int num_threads = thread_list != NULL ? parse_thread_list(thread_list, threads, SWEEP_MAX_CONFIGS) : 1;
+    int num_bindings = binding_list != NULL ? parse_bindings(binding_list, bindings) : 1;
+    int count = 0;
+
+    if (num_threads <= 0 || num_bindings <= 0) {
+        return -1;
+    }
+    for (int b = 0; b < num_bindings; b++) {
+        for (int t = 0; t < num_threads; t++) {
+            if (count == max) {
+                return -1;
+            }
+            configs[count].threads = threads[t];
+            configs[count].binding = bindings[b];
+            count++;
+        }
+    }
+    return count;
+}
+
+// Linux CPU list, e.g. 0-3,64-67
+void parse_cpu_list(const char *list, cpu_set_t *set) {
+    const char *p = list;
+    CPU_ZERO(set);
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p) {
+            break;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, set);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+}
+
+// Called before any pinning, while the master thread still has the affinity of the process.
+// Returns -1 if the affinity cannot be read
+int sweep_places_init(struct sweep_places *places) {
+    cpu_set_t allowed, assigned;
+
+    CPU_ZERO(&assigned);
+    places->count = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE && places->count < SWEEP_MAX_THREADS; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed) || CPU_ISSET(cpu, &assigned)) {
+            continue;
+        }
+        char path[128], list[256];
+        cpu_set_t *core = &places->cores[places->count++];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+        FILE *file = fopen(path, "r");
+        if (file != NULL && fgets(list, sizeof(list), file) != NULL) {
+            parse_cpu_list(list, core);
+            CPU_AND(core, core, &allowed);
+        } else {
+            CPU_ZERO(core);
+        }
+        if (file != NULL) {
+            fclose(file);
+        }
+        CPU_SET(cpu, core);
+        CPU_OR(&assigned, &assigned, core);
+    }
+    return 0;
+}
+
+// More threads than places wrap around
+int sweep_place(const struct sweep_places *places, int binding, int thread, int threads) {
+    if (binding == BIND_SPREAD && threads <= places->count) {
+        return (int)((long)thread * places->count / threads);
+    }
+    return thread % places->count;
+}
+
+// Returns the number of threads that could not be pinned
+int sweep_pin(const struct sweep_places *places, int binding, int threads) {
+    int failures = 0;
+    omp_set_num_threads(threads);
+#pragma omp parallel reduction(+:failures)
+    {
+        int place = sweep_place(places, binding, omp_get_thread_num(), omp_get_num_threads());
+        failures += sched_setaffinity(0, sizeof(cpu_set_t), &places->cores[place]) != 0;
+    }
+    return failures;
+}
+
+// The CPUs of the team in thread order, separated by spaces so that they fit in a CSV column.
+// Returns the number of threads outside their place, always 0 without places.
+int sweep_record(const struct sweep_places *places, int binding, char *buffer, size_t size) {
+    int cpus[SWEEP_MAX_THREADS];
+    int threads = 0, outside = 0;
+    size_t used = 0;
+
+#pragma omp parallel reduction(+:outside)
+    {
+        int t = omp_get_thread_num(), cpu = sched_getcpu();
+#pragma omp single
+        threads = omp_get_num_threads() < SWEEP_MAX_THREADS ? omp_get_num_threads() : SWEEP_MAX_THREADS;
+        if (t < SWEEP_MAX_THREADS) {
+            cpus[t] = cpu;
+            if (places != NULL) {
+                outside += cpu < 0 || !CPU_ISSET(cpu, &places->cores[sweep_place(places, binding, t, omp_get_num_threads())]);
+            }
+        }
+    }
+
+    buffer[0] = '\0';
+    for (int t = 0; t < threads && used + 1 < size; t++) {
+        int written = snprintf(buffer + used, size - used, t == 0 ? "%d" : " %d", cpus[t]);
+        if (written < 0 || (size_t)written >= size - used) {
+            break;
+        }
+        used += written;
+    }
+    return outside;
+}
+
+// %t in the label becomes the thread count, e.g. -l %t for one line per count
+void sweep_label(char *buffer, size_t size, const char *label, int threads) {
+    const char *mark = strstr(label, "%t");
+    if (mark == NULL) {
+        snprintf(buffer, size, "%s", label);
+    } else {
+        snprintf(buffer, size, "%.*s%d%s", (int)(mark - label), label, threads, mark + 2);
+    }
+}
@@ -24,26 +24,29 @@ cd $location
 policy=spread
 arch=EPYC #architecture
 
-export OMP_PLACES=cores
-export OMP_PROC_BIND=$policy
-export OMP_NUM_THREADS=64
+# gemm.x pins the threads itself (-T, -A) and writes the CPUs it found them on
+threads=64
 
 
-for lib in openblas mkl blis; do
-  for prec in float double; do
+for lib in openblas mkl blis native; do
+  for prec in float double bf16 fp16; do
     file="${lib}_${prec}.csv"
-    echo "matrix_size,time_mean(s),time_sd,GFLOPS_mean,GFLOPS_sd" > $file
+    echo "matrix_size,time_mean(s),time_sd,GFLOPS_mean,GFLOPS_sd,time_min(s),time_p10(s),time_median(s),time_p90(s),GFLOPS_median,trials,placement,max_rel_error,freivalds_residual,verified,threads,cores" > $file
+    [ $prec = float ] || [ $prec = double ] || continue
+    file="${lib}_${prec}_batch.csv"
+    echo "matrix_size,layout,api,batch,time_mean(s),time_sd,GFLOPS_mean,GFLOPS_sd,time_min(s),time_p10(s),time_median(s),time_p90(s),GFLOPS_median,trials,placement,verified,threads,cores" > $file
   done
 done
 
 for i in {0..18}; do
   let size=$((2000+1000*$i))
-  for lib in openblas mkl blis; do
-    for prec in float double; do
-      echo -n "${size}," >> ${lib}_${prec}.csv
-      ./${lib}_${prec}.x $size $size $size
-    done
-  done
+  ./gemm.x -T $threads -A $policy -b openblas,mkl,blis,native -p float,double,bf16,fp16 -l ${size} $size $size $size
+done
+
+# Batches of small products, about 2 GFLOP per call
+for size in 32 48 64 96 128 192 256; do
+  let batch=$((1000000000/($size*$size*$size)))
+  ./gemm.x -B $batch -T $threads -A $policy -b openblas,mkl,blis,native -p float,double -l ${size} $size $size $size
 done
 
 cd ../../..
@@ -0,0 +1,49 @@
+#!/bin/bash
+#SBATCH --no-requeue
+#SBATCH --job-name="scal_ex2_summa"
+#SBATCH -n 256
+#SBATCH -N 2
+#SBATCH --get-user-env
+#SBATCH --partition=EPYC
+#SBATCH --exclusive
+#SBATCH --time=02:00:00
+
+module load architecture/AMD
+module load mkl
+module load openBLAS/0.3.21-omp
+module load openMPI/4.1.5/gnu/12.2.1
+export LD_LIBRARY_PATH=/u/dssc/acampa00/myblis/lib:$LD_LIBRARY_PATH
+
+location=$(pwd)
+
+cd ../../..
+make clean loc=$location
+make mpi loc=$location
+
+
+cd $location
+policy=close
+arch=EPYC #architecture
+
+# One rank per socket, its threads on the cores of the socket
+export OMP_PLACES=cores
+export OMP_PROC_BIND=$policy
+export OMP_NUM_THREADS=64
+
+for lib in openblas mkl blis native; do
+  for prec in float double; do
+    file="${lib}_${prec}_summa.csv"
+    echo "#ranks,time_mean(s),time_sd,GFLOPS_mean,GFLOPS_sd,time_min(s),time_p10(s),time_median(s),time_p90(s),GFLOPS_median,trials,placement,grid,ranks,nodes,threads,node_GFLOPS_min,node_GFLOPS_max,max_rel_error,freivalds_residual,verified" > $file
+  done
+done
+
+# From one socket to the two sockets of both nodes, at a fixed size
+size=30000
+for ranks in 1 2 4; do
+  mpirun -np $ranks --map-by ppr:1:socket:PE=64 --bind-to core ./gemm_mpi.x -b openblas,mkl,blis,native -p float,double -n 10 -l ${ranks} $size $size $size
+done
+
+cd ../../..
+make clean loc=$location
+module purge
+
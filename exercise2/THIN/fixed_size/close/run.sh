@@ -26,38 +26,23 @@ cd $location
 policy=close
 arch=THIN #architecture
 
-export OMP_PLACES=cores
-export OMP_PROC_BIND=$policy
+# gemm.x pins the threads itself (-T, -A) and writes the CPUs it found them on
 
 
 
-for lib in openblas mkl blis; do
+for lib in openblas mkl blis native; do
   for prec in float double; do
     file="${lib}_${prec}.csv"
-    echo "#cores,time_mean(s),time_sd,GFLOPS_mean,GFLOPS_sd" > $file
+    echo "#cores,time_mean(s),time_sd,GFLOPS_mean,GFLOPS_sd,time_min(s),time_p10(s),time_median(s),time_p90(s),GFLOPS_median,trials,placement,max_rel_error,freivalds_residual,verified,threads,cores" > $file
+    file="${lib}_${prec}_batch.csv"
+    echo "#cores,layout,api,batch,time_mean(s),time_sd,GFLOPS_mean,GFLOPS_sd,time_min(s),time_p10(s),time_median(s),time_p90(s),GFLOPS_median,trials,placement,verified,threads,cores" > $file
   done
 done
 
-export OMP_NUM_THREADS=1
-  for lib in openblas mkl blis; do
-    for prec in float double; do
-      echo -n "1," >> ${lib}_${prec}.csv
-      ./${lib}_${prec}.x $size $size $size
-    done
-  done
-
-
-for cores in $(seq 1 1 24)
-do
-  export BLIS_NUM_THREADS=$cores
-  export OMP_NUM_THREADS=$cores
-  for lib in openblas mkl blis; do
-    for prec in float double; do
-      echo -n "${cores}," >> ${lib}_${prec}.csv
-      ./${lib}_${prec}.x $size $size $size
-    done
-  done
-done
+# -t tunes native and BLIS for every thread count first, the results are kept in gemm_tune_<host>.cfg
+threads=1-24
+./gemm.x -t -T $threads -A $policy -b openblas,mkl,blis,native -p float,double -l %t $size $size $size
+./gemm.x -B 4000 -T $threads -A $policy -b openblas,mkl,blis,native -p float,double -l %t 64 64 64
 
 cd ../../..
 make clean loc=$location
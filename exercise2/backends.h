@@ -0,0 +1,179 @@
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Values of the CBLAS enums, the libraries are loaded at runtime so their headers are not included
+#define GEMM_COL_MAJOR 102
+#define GEMM_NO_TRANS 111
+
+#define MAX_BACKENDS 8
+
+typedef void (*sgemm_fn)(int order, int transa, int transb, int m, int n, int k,
+                         float alpha, const float *A, int lda, const float *B, int ldb,
+                         float beta, float *C, int ldc);
+typedef void (*dgemm_fn)(int order, int transa, int transb, int m, int n, int k,
+                         double alpha, const double *A, int lda, const double *B, int ldb,
+                         double beta, double *C, int ldc);
+
+// bf16 and fp16 inputs with fp32 accumulation and output, as MKL cblas_gemm_bf16bf16f32 and
+// cblas_gemm_f16f16f32 or OpenBLAS cblas_sbgemm. bf16 is kept as its raw 16 bits.
+typedef uint16_t gemm_bf16;
+typedef _Float16 gemm_fp16;
+typedef void (*mixed_gemm_fn)(int order, int transa, int transb, int m, int n, int k,
+                              float alpha, const void *A, int lda, const void *B, int ldb,
+                              float beta, float *C, int ldc);
+
+typedef void (*library_threads_fn)(int threads);
+typedef void (*blis_threads_fn)(long threads);
+
+// A GEMM implementation behind the CBLAS interface.
+// External libraries are opened with dlopen: the path can be forced with the environment variable
+// in env, otherwise the sonames in libraries are tried in order (they are found through LD_LIBRARY_PATH).
+// The bf16 and fp16 entries are optional, they stay NULL if the library has no such interface.
+struct gemm_backend {
+    const char *name;
+    const char *env;
+    const char *libraries[4];
+    void *handle;
+    sgemm_fn sgemm;
+    dgemm_fn dgemm;
+    mixed_gemm_fn bf16gemm;
+    mixed_gemm_fn fp16gemm;
+};
+
+void reference_sgemm(int order, int transa, int transb, int m, int n, int k, float alpha, const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc);
+void reference_dgemm(int order, int transa, int transb, int m, int n, int k, double alpha, const double *A, int lda, const double *B, int ldb, double beta, double *C, int ldc);
+void reference_gemm_bf16(int order, int transa, int transb, int m, int n, int k, float alpha, const void *A, int lda, const void *B, int ldb, float beta, float *C, int ldc);
+void reference_gemm_fp16(int order, int transa, int transb, int m, int n, int k, float alpha, const void *A, int lda, const void *B, int ldb, float beta, float *C, int ldc);
+void native_sgemm(int order, int transa, int transb, int m, int n, int k, float alpha, const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc);
+void native_dgemm(int order, int transa, int transb, int m, int n, int k, double alpha, const double *A, int lda, const double *B, int ldb, double beta, double *C, int ldc);
+void native_gemm_bf16(int order, int transa, int transb, int m, int n, int k, float alpha, const void *A, int lda, const void *B, int ldb, float beta, float *C, int ldc);
+void native_gemm_fp16(int order, int transa, int transb, int m, int n, int k, float alpha, const void *A, int lda, const void *B, int ldb, float beta, float *C, int ldc);
+float bf16_to_float(gemm_bf16 x);
+gemm_bf16 float_to_bf16(float x);
+struct gemm_backend *find_backend(const char *name);
+int load_backend(struct gemm_backend *backend);
+void set_backend_threads(struct gemm_backend *backend, int threads);
+
+struct gemm_backend backends[] = {
+    {"mkl", "GEMM_MKL_LIB", {"libmkl_rt.so", "libmkl_rt.so.2", "libmkl_rt.so.1", NULL}},
+    {"openblas", "GEMM_OPENBLAS_LIB", {"libopenblas.so", "libopenblas.so.0", NULL}},
+    {"blis", "GEMM_BLIS_LIB", {"libblis.so", "libblis.so.4", "libblis.so.3", NULL}},
+    {"native", NULL, {NULL}, NULL, native_sgemm, native_dgemm, native_gemm_bf16, native_gemm_fp16},
+    {"reference", NULL, {NULL}, NULL, reference_sgemm, reference_dgemm, reference_gemm_bf16, reference_gemm_fp16},
+};
+const int num_backends = sizeof(backends) / sizeof(backends[0]);
+
+float bf16_to_float(gemm_bf16 x) {
+    union { uint32_t u; float f; } v = {(uint32_t)x << 16};
+    return v.f;
+}
+
+// Round to nearest even, as the hardware conversions do
+gemm_bf16 float_to_bf16(float x) {
+    union { float f; uint32_t u; } v = {x};
+    return (gemm_bf16)((v.u + 0x7fff + ((v.u >> 16) & 1)) >> 16);
+}
+
+#define BF16_LOAD(x) bf16_to_float(x)
+#define FP16_LOAD(x) ((float)(x))
+#define COPY_LOAD(x) (x)
+
+// Naive column major C = alpha*A*B + beta*C, only meant as a fallback and a correctness baseline.
+// IN_TYPE is the storage of A and B, ARG_TYPE their type in the signature, LOAD widens one element to TYPE.
+#define REFERENCE_GEMM(NAME, TYPE, IN_TYPE, ARG_TYPE, LOAD)                                         \
+void NAME(int order, int transa, int transb, int m, int n, int k, TYPE alpha, const ARG_TYPE *vA,   \
+          int lda, const ARG_TYPE *vB, int ldb, TYPE beta, TYPE *C, int ldc) {                      \
+    const IN_TYPE *A = vA, *B = vB;                                                                 \
+    _Pragma("omp parallel for schedule(static)")                                                    \
+    for (int j = 0; j < n; j++) {                                                                   \
+        for (int i = 0; i < m; i++) {                                                               \
+            C[i + (long)j * ldc] = beta == 0 ? 0 : beta * C[i + (long)j * ldc];                     \
+        }                                                                                           \
+        for (int p = 0; p < k; p++) {                                                               \
+            TYPE b = alpha * LOAD(B[p + (long)j * ldb]);                                            \
+            for (int i = 0; i < m; i++) {                                                           \
+                C[i + (long)j * ldc] += LOAD(A[i + (long)p * lda]) * b;                             \
+            }                                                                                       \
+        }                                                                                           \
+    }                                                                                               \
+}
+
+REFERENCE_GEMM(reference_sgemm, float, float, float, COPY_LOAD)
+REFERENCE_GEMM(reference_dgemm, double, double, double, COPY_LOAD)
+REFERENCE_GEMM(reference_gemm_bf16, float, gemm_bf16, void, BF16_LOAD)
+REFERENCE_GEMM(reference_gemm_fp16, float, gemm_fp16, void, FP16_LOAD)
+
+struct gemm_backend *find_backend(const char *name) {
+    for (int b = 0; b < num_backends; b++) {
+        if (strcmp(backends[b].name, name) == 0) {
+            return &backends[b];
+        }
+    }
+    return NULL;
+}
+
+// Returns 0 if the backend can be used.
+// Libraries stay loaded until exit: closing a BLAS with a live thread pool is not safe.
+int load_backend(struct gemm_backend *backend) {
+    if (backend->sgemm != NULL && backend->dgemm != NULL) {
+        return 0;
+    }
+
+    // MKL has to use the GNU OpenMP runtime the driver is linked with (as -lmkl_gnu_thread did)
+    if (strcmp(backend->name, "mkl") == 0) {
+        setenv("MKL_THREADING_LAYER", "GNU", 0);
+    }
+
+    const char *path = backend->env != NULL ? getenv(backend->env) : NULL;
+    if (path != NULL) {
+        backend->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    }
+    for (int l = 0; backend->handle == NULL && backend->libraries[l] != NULL; l++) {
+        backend->handle = dlopen(backend->libraries[l], RTLD_NOW | RTLD_LOCAL);
+    }
+    if (backend->handle == NULL) {
+        fprintf(stderr, " Backend %s not available: %s\n", backend->name, dlerror());
+        return -1;
+    }
+
+    backend->sgemm = (sgemm_fn)dlsym(backend->handle, "cblas_sgemm");
+    backend->dgemm = (dgemm_fn)dlsym(backend->handle, "cblas_dgemm");
+    backend->bf16gemm = (mixed_gemm_fn)dlsym(backend->handle, "cblas_gemm_bf16bf16f32");
+    if (backend->bf16gemm == NULL) {
+        backend->bf16gemm = (mixed_gemm_fn)dlsym(backend->handle, "cblas_sbgemm");
+    }
+    backend->fp16gemm = (mixed_gemm_fn)dlsym(backend->handle, "cblas_gemm_f16f16f32");
+    if (backend->sgemm == NULL || backend->dgemm == NULL) {
+        fprintf(stderr, " Backend %s has no CBLAS interface\n", backend->name);
+        dlclose(backend->handle);
+        backend->handle = NULL;
+        backend->sgemm = NULL;
+        backend->dgemm = NULL;
+        backend->bf16gemm = NULL;
+        backend->fp16gemm = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// OpenBLAS and MKL keep a thread count of their own next to OpenMP's, BLIS takes a dim_t.
+// The built-in backends follow omp_set_num_threads.
+void set_backend_threads(struct gemm_backend *backend, int threads) {
+    if (backend->handle == NULL) {
+        return;
+    }
+    library_threads_fn set_threads = (library_threads_fn)dlsym(backend->handle, "openblas_set_num_threads");
+    if (set_threads == NULL) {
+        set_threads = (library_threads_fn)dlsym(backend->handle, "MKL_Set_Num_Threads");
+    }
+    if (set_threads != NULL) {
+        set_threads(threads);
+    }
+    blis_threads_fn set_blis_threads = (blis_threads_fn)dlsym(backend->handle, "bli_thread_set_num_threads");
+    if (set_blis_threads != NULL) {
+        set_blis_threads(threads);
+    }
+}
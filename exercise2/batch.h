@@ -0,0 +1,100 @@
+#include <dlfcn.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Batches of independent small products C_i = A_i * B_i, all of the same shape.
+// Two layouts are timed:
+//   strided  A_i = A + i * m * k, B_i = B + i * k * n, C_i = C + i * m * n
+//   pointer  arrays of pointers to the same matrices
+// Libraries that export the MKL batch interface (cblas_?gemm_batch, cblas_?gemm_batch_strided)
+// get the whole batch in one call. For the others, and for the native backend, the items are
+// spread over the OpenMP threads and every product runs single threaded inside its thread.
+
+enum batch_layout { BATCH_STRIDED, BATCH_POINTER, NUM_LAYOUTS };
+const char *batch_layout_names[NUM_LAYOUTS] = {"strided", "pointer"};
+
+typedef void (*sgemm_batch_fn)(int layout, const int *transa, const int *transb, const int *m, const int *n, const int *k,
+                               const float *alpha, const float **A, const int *lda, const float **B, const int *ldb,
+                               const float *beta, float **C, const int *ldc, int group_count, const int *group_size);
+typedef void (*dgemm_batch_fn)(int layout, const int *transa, const int *transb, const int *m, const int *n, const int *k,
+                               const double *alpha, const double **A, const int *lda, const double **B, const int *ldb,
+                               const double *beta, double **C, const int *ldc, int group_count, const int *group_size);
+typedef void (*sgemm_batch_strided_fn)(int layout, int transa, int transb, int m, int n, int k, float alpha,
+                                       const float *A, int lda, int stride_a, const float *B, int ldb, int stride_b,
+                                       float beta, float *C, int ldc, int stride_c, int batch_size);
+typedef void (*dgemm_batch_strided_fn)(int layout, int transa, int transb, int m, int n, int k, double alpha,
+                                       const double *A, int lda, int stride_a, const double *B, int ldb, int stride_b,
+                                       double beta, double *C, int ldc, int stride_c, int batch_size);
+
+struct gemm_batch {
+    struct gemm_backend *backend;
+    size_t type_size;
+    int layout;
+    int count;
+    int m, k, n;
+    void *A, *B, *C;
+    void **a_array, **b_array, **c_array;  // pointer layout only
+    void *api;                              // library batch entry point, NULL for the OpenMP loop
+};
+
+void *batch_api(struct gemm_backend *backend, size_t type_size, int layout);
+void run_gemm_batch(void *argument);
+
+// The library entry point for this precision and layout, NULL if there is none
+void *batch_api(struct gemm_backend *backend, size_t type_size, int layout) {
+    const char *names[2][NUM_LAYOUTS] = {
+        {"cblas_sgemm_batch_strided", "cblas_sgemm_batch"},
+        {"cblas_dgemm_batch_strided", "cblas_dgemm_batch"},
+    };
+    if (backend->handle == NULL) {
+        return NULL;
+    }
+    return dlsym(backend->handle, names[type_size == sizeof(float) ? 0 : 1][layout]);
+}
+
+// Inner products cannot fork again, the backends see one thread
+#define BATCH_GEMM(NAME, TYPE, GEMM, BATCH_FN, STRIDED_FN)                                           \
+void NAME(struct gemm_batch *batch) {                                                                \
+    int m = batch->m, k = batch->k, n = batch->n;                                                    \
+    TYPE one = 1, zero = 0;                                                                          \
+    if (batch->api != NULL && batch->layout == BATCH_STRIDED) {                                      \
+        ((STRIDED_FN)batch->api)(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k,              \
+            one, batch->A, m, m * k, batch->B, k, k * n, zero, batch->C, m, m * n, batch->count);    \
+    } else if (batch->api != NULL) {                                                                 \
+        int no_trans = GEMM_NO_TRANS;                                                                \
+        ((BATCH_FN)batch->api)(GEMM_COL_MAJOR, &no_trans, &no_trans, &m, &n, &k, &one,               \
+            (const TYPE **)batch->a_array, &m, (const TYPE **)batch->b_array, &k, &zero,             \
+            (TYPE **)batch->c_array, &m, 1, &batch->count);                                          \
+    } else {                                                                                         \
+        _Pragma("omp parallel for schedule(static)")                                                 \
+        for (int i = 0; i < batch->count; i++) {                                                     \
+            const TYPE *a, *b;                                                                       \
+            TYPE *c;                                                                                 \
+            if (batch->layout == BATCH_STRIDED) {                                                    \
+                a = (const TYPE *)batch->A + (long)i * m * k;                                        \
+                b = (const TYPE *)batch->B + (long)i * k * n;                                        \
+                c = (TYPE *)batch->C + (long)i * m * n;                                              \
+            } else {                                                                                 \
+                a = batch->a_array[i];                                                               \
+                b = batch->b_array[i];                                                               \
+                c = batch->c_array[i];                                                               \
+            }                                                                                        \
+            batch->backend->GEMM(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS,                       \
+                                 m, n, k, one, a, m, b, k, zero, c, m);                              \
+        }                                                                                            \
+    }                                                                                                \
+}
+
+BATCH_GEMM(sgemm_batch, float, sgemm, sgemm_batch_fn, sgemm_batch_strided_fn)
+BATCH_GEMM(dgemm_batch, double, dgemm, dgemm_batch_fn, dgemm_batch_strided_fn)
+
+void run_gemm_batch(void *argument) {
+    struct gemm_batch *batch = argument;
+    if (batch->type_size == sizeof(float)) {
+        sgemm_batch(batch);
+    } else {
+        dgemm_batch(batch);
+    }
+}
@@ -0,0 +1,135 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Timing harness: untimed warm-up calls, then timed trials until both the requested number of
+// trials is reached and the 95% confidence interval of the mean time is within the requested
+// fraction of the mean (or BENCH_MAX_TRIALS is hit). Mean and variance are accumulated with
+// Welford's update; median and percentiles come from the sorted samples.
+// With flushing on, a buffer larger than the last level caches is rewritten by all the threads
+// before every trial, so each call starts from memory as it would inside an application.
+
+#define BENCH_MAX_TRIALS 1000
+#define BENCH_DEFAULT_FLUSH_MB 512  // covers the 2 x 256 MB of L3 of an EPYC node
+
+struct bench_options {
+    int warmup;          // untimed calls before the first trial
+    int trials;          // minimum number of timed trials
+    double confidence;   // target half width of the 95% interval over the mean, 0 to disable
+    int flush;           // flush the caches before every trial
+};
+
+struct bench_result {
+    int trials;
+    double time_mean, time_sd, time_min, time_p10, time_median, time_p90;
+    double gflops_mean, gflops_sd, gflops_median;
+};
+
+struct welford {
+    long count;
+    double mean, m2;
+};
+
+void welford_update(struct welford *w, double x);
+double welford_sd(const struct welford *w);
+int compare_doubles(const void *a, const void *b);
+double percentile(const double *sorted, int count, double q);
+void flush_caches();
+void bench_run(void (*call)(void *), void *argument, double flops, const struct bench_options *options, struct bench_result *result);
+
+void welford_update(struct welford *w, double x) {
+    w->count++;
+    double delta = x - w->mean;
+    w->mean += delta / w->count;
+    w->m2 += delta * (x - w->mean);
+}
+
+// Sample standard deviation
+double welford_sd(const struct welford *w) {
+    return w->count > 1 ? sqrt(w->m2 / (w->count - 1)) : 0.0;
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Linear interpolation between the closest ranks, q in [0, 1]
+double percentile(const double *sorted, int count, double q) {
+    double position = q * (count - 1);
+    int below = (int)position;
+    if (below >= count - 1) {
+        return sorted[count - 1];
+    }
+    return sorted[below] + (position - below) * (sorted[below + 1] - sorted[below]);
+}
+
+// The size can be changed with GEMM_FLUSH_MB, the buffer is allocated at the first call
+void flush_caches() {
+    static char *buffer = NULL;
+    static size_t size = 0;
+    if (buffer == NULL) {
+        const char *mb = getenv("GEMM_FLUSH_MB");
+        size = (size_t)(mb != NULL ? atol(mb) : BENCH_DEFAULT_FLUSH_MB) << 20;
+        buffer = malloc(size);
+        if (buffer == NULL) {
+            fprintf(stderr, " Unable to allocate the cache flush buffer\n");
+            exit(1);
+        }
+    }
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < size; i += 64) {
+        buffer[i]++;
+    }
+}
+
+void bench_run(void (*call)(void *), void *argument, double flops, const struct bench_options *options, struct bench_result *result) {
+    struct timespec begin, end;
+    struct welford time = {0}, gflops = {0};
+    double *samples = malloc(BENCH_MAX_TRIALS * sizeof(double));
+    int count = 0;
+
+    if (samples == NULL) {
+        fprintf(stderr, " Unable to allocate the timing samples\n");
+        exit(1);
+    }
+
+    for (int w = 0; w < options->warmup; w++) {
+        call(argument);
+    }
+
+    while (count < BENCH_MAX_TRIALS) {
+        if (count >= options->trials) {
+            double half_width = 1.96 * welford_sd(&time) / sqrt((double)count);
+            if (options->confidence <= 0 || half_width <= options->confidence * time.mean) {
+                break;
+            }
+        }
+        if (options->flush) {
+            flush_caches();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        call(argument);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed = (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) * 1.0e-9;
+        samples[count++] = elapsed;
+        welford_update(&time, elapsed);
+        welford_update(&gflops, flops / elapsed * 1.0e-9);
+    }
+
+    qsort(samples, count, sizeof(double), compare_doubles);
+    result->trials = count;
+    result->time_mean = time.mean;
+    result->time_sd = welford_sd(&time);
+    result->time_min = samples[0];
+    result->time_p10 = percentile(samples, count, 0.10);
+    result->time_median = percentile(samples, count, 0.50);
+    result->time_p90 = percentile(samples, count, 0.90);
+    result->gflops_mean = gflops.mean;
+    result->gflops_sd = welford_sd(&gflops);
+    result->gflops_median = flops / result->time_median * 1.0e-9;
+    free(samples);
+}
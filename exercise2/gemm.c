@@ -5,185 +5,513 @@
  * modifiedby: Stefano Cozzini for DSSC usage
  */
 
+#define _GNU_SOURCE  // sched_setaffinity and sched_getcpu, see sweep.h
 #define min(x,y) (((x) < (y)) ? (x) : (y))
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
-
-#ifdef MKL 
-#include "mkl_cblas.h"
-#endif
-
-#ifdef OPENBLAS
-#include "cblas.h"
-#endif
-
-#ifdef BLIS
-#include "cblas.h"
-#endif
-
 #include <time.h>
 #include <unistd.h>
 
-#ifdef USE_FLOAT
-#define MYFLOAT float
-#define DATATYPE printf(" Using float \n\n");
-#define GEMMCPU cblas_sgemm
-#ifdef MKL
-#define RESULTS  "mkl_float.csv"
-#endif
-#ifdef OPENBLAS
-#define RESULTS "openblas_float.csv"
-#endif
-#ifdef BLIS
-#define RESULTS "blis_float.csv"
-#endif
+#include "backends.h"
+#include "native_gemm.h"
+#include "precision.h"
+#include "verify.h"
+#include "tune.h"
+#include "bench.h"
+#include "placement.h"
+#include "batch.h"
+#include "sweep.h"
+#ifdef WITH_MPI
+#include "summa.h"
 #endif
 
-#ifdef USE_DOUBLE
-#define MYFLOAT double 
-#define DATATYPE printf(" Using double \n\n");
-#define GEMMCPU cblas_dgemm
-#ifdef MKL
-#define RESULTS  "mkl_double.csv"
-#endif
-#ifdef OPENBLAS
-#define RESULTS "openblas_double.csv"
-#endif
-#ifdef BLIS
-#define RESULTS "blis_double.csv"
-#endif
-#endif
+#define DEFAULT_BACKENDS "mkl,openblas,blis,native"
+#define DEFAULT_PRECISIONS "float,double"
+#define DEFAULT_TRIALS 30
+#define DEFAULT_WARMUP 2
 
-struct timespec diff(struct timespec start, struct timespec end)
-{
-        struct timespec temp;
-        if ((end.tv_nsec-start.tv_nsec)<0) {
-                temp.tv_sec = end.tv_sec-start.tv_sec-1;
-                temp.tv_nsec = 1000000000+end.tv_nsec-start.tv_nsec;
-        } else {
-                temp.tv_sec = end.tv_sec-start.tv_sec;
-                temp.tv_nsec = end.tv_nsec-start.tv_nsec;
-        }
-        return temp;
-}
+// Arguments of one timed call, see bench_run
+struct gemm_call {
+    struct gemm_backend *backend;
+    int precision;
+    int m, k, n;
+    void *A, *B, *C;
+    void *workspace;  // float-refined only
+};
 
+int parse_precisions(const char *list, int *precisions);
+int parse_backends(const char *list, struct gemm_backend **selected);
+void initialize_matrices(int precision, int parallel, void *A, void *B, void *C, int m, int k, int n);
+int supports_precision(struct gemm_backend *backend, int precision);
+void run_gemm(struct gemm_backend *backend, int precision, int m, int k, int n, void *A, void *B, void *C, void *workspace);
+void run_gemm_call(void *argument);
+int benchmark(struct gemm_backend *backend, int precision, int m, int k, int n, void *A, void *B, void *C, void *workspace, const struct bench_options *options, const char *label, const char *placement, const char *cores);
+int benchmark_batch(struct gemm_backend *backend, int precision, int layout, int count, int m, int k, int n, void *A, void *B, void *C, void **arrays, const struct bench_options *options, const char *label, const char *placement, const char *cores);
+void print_corners(int precision, int m, int k, int n, void *A, void *B, void *C);
+#ifdef WITH_MPI
+void finalize_mpi();
+int run_distributed(struct gemm_backend **selected, int num_selected, const int *precisions, int num_precisions, int m, int k, int n, struct bench_options *options, const struct tune_entry *tune_entries, int num_tune_entries, const char *label, int placement);
+int benchmark_summa(struct summa_call *call, const struct bench_options *options, const char *label, const char *placement);
+#endif
 
 int main(int argc, char** argv)
 {
-    MYFLOAT *A, *B, *C;
-    int m, n, k, i, j;
-    MYFLOAT alpha, beta;
-    struct timespec begin, end;
-    double elapsed;
-    if (argc == 1)
+    void *A, *B, *C;
+    int m, n, k;
+    int option;
+    struct bench_options options = {DEFAULT_WARMUP, DEFAULT_TRIALS, 0.0, 0};
+    int precisions[NUM_PRECISIONS], num_precisions;
+    struct gemm_backend *selected[MAX_BACKENDS];
+    int num_selected;
+    const char *backend_list = DEFAULT_BACKENDS;
+    const char *precision_list = DEFAULT_PRECISIONS;
+    const char *label = NULL;
+    int placement = PLACE_FIRST_TOUCH;
+    char placement_description[64];
+    const char *thread_list = NULL;
+    const char *binding_list = NULL;
+    static struct sweep_config configs[SWEEP_MAX_CONFIGS];
+    static struct sweep_places places;
+    int num_configs = 1, sweeping;
+    int tune = 0;
+    int failures = 0;  // products that failed verification
+    int batch = 0;
+    void **batch_arrays = NULL;
+    void *workspace = NULL;
+    struct tune_entry tune_entries[TUNE_MAX_ENTRIES];
+    int num_tune_entries;
+
+#ifdef WITH_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    atexit(finalize_mpi);
+#endif
+
+    while ((option = getopt(argc, argv, "tfb:p:n:w:r:m:B:l:T:A:")) != -1) {
+        switch (option) {
+            case 'b':  // Comma separated backends
+                backend_list = optarg;
+                break;
+            case 'p':  // Comma separated precisions
+                precision_list = optarg;
+                break;
+            case 'n':  // Minimum number of timed trials
+                options.trials = atoi(optarg);
+                break;
+            case 'w':  // Untimed warm-up calls
+                options.warmup = atoi(optarg);
+                break;
+            case 'r':  // Repeat until the 95% confidence interval is within this fraction of the mean, e.g. 0.01
+                options.confidence = atof(optarg);
+                break;
+            case 'f':  // Flush the caches before every trial
+                options.flush = 1;
+                break;
+            case 'm':  // Placement of the matrices: first-touch, interleave or serial
+                placement = parse_placement(optarg);
+                if (placement < 0) {
+                    printf(" Unknown placement %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'B':  // Batched mode: time this many independent M K N products per call
+                batch = atoi(optarg);
+                break;
+            case 'l':  // Write the results to <backend>_<precision>.csv, with this label as first column (%t for the threads)
+                label = optarg;
+                break;
+            case 'T':  // Sweep over these thread counts, e.g. 1,2,4-64:4
+                thread_list = optarg;
+                break;
+            case 'A':  // Sweep over these bindings, close and/or spread
+                binding_list = optarg;
+                break;
+            case 't':  // Autotune the tunable backends for this shape before timing them
+                tune = 1;
+                break;
+            default:
+                printf("Usage: %s [-t] [-b backends] [-p precisions] [-n trials] [-w warmup] [-r confidence] [-f] [-m placement] [-B batch] [-T threads] [-A bindings] [-l csv_label] [M K N], the corresponding matrices will be  A(M,K) B(K,N) \n", argv[0]);
+                return 0;
+        }
+    }
+
+    if (optind == argc)
     {
     m = 2000, k = 200, n = 1000;
     }
-    else if (argc == 4)
+    else if (argc - optind == 3)
     {
-        m = atoi(argv[1]);
-        k = atoi(argv[2]);
-        n = atoi(argv[3]);
+        m = atoi(argv[optind]);
+        k = atoi(argv[optind + 1]);
+        n = atoi(argv[optind + 2]);
     }
     else
     {
-    printf( "Usage: %s M K N, the corresponding matrices will be  A(M,K) B(K,N) \n", argv[0]); 
-    return 0; 
+    printf( "Usage: %s [-t] [-b backends] [-p precisions] [-n trials] [-w warmup] [-r confidence] [-f] [-m placement] [-B batch] [-T threads] [-A bindings] [-l csv_label] M K N, the corresponding matrices will be  A(M,K) B(K,N) \n", argv[0]);
+    return 0;
     }
 
+    num_precisions = parse_precisions(precision_list, precisions);
+    num_selected = parse_backends(backend_list, selected);
+    if (num_precisions <= 0 || num_selected <= 0 || options.trials <= 0 || options.warmup < 0 || batch < 0) {
+      printf( "\n ERROR: No usable backend or precision selected. Aborting... \n\n");
+      return 1;
+    }
+    if (m <= 0 || k <= 0 || n <= 0) {
+      printf( "\n ERROR: M, K and N must be positive, got %d %d %d. Aborting... \n\n", m, k, n);
+      return 1;
+    }
+    if (options.trials > BENCH_MAX_TRIALS) {
+      printf( "\n ERROR: -n %d is above the %d trials a run can record. Aborting... \n\n", options.trials, BENCH_MAX_TRIALS);
+      return 1;
+    }
+    num_tune_entries = tune_load(tune_entries, TUNE_MAX_ENTRIES);
+    sweeping = thread_list != NULL || binding_list != NULL;
+#ifdef WITH_MPI
+    if (batch > 0 || tune || sweeping) {
+      printf( "\n ERROR: -B, -t, -T and -A are not available with MPI, use gemm.x on one node. Aborting... \n\n");
+      return 1;
+    }
+    return run_distributed(selected, num_selected, precisions, num_precisions, m, k, n, &options, tune_entries, num_tune_entries, label, placement);
+#endif
 
     printf ("\n This example computes real matrix C=alpha*A*B+beta*C using \n"
-            " BLAS function dgemm, where A, B, and  C are matrices and \n"
+            " BLAS function gemm, where A, B, and  C are matrices and \n"
             " alpha and beta are scalars\n\n");
 
 
     printf (" Initializing data for matrix multiplication C=A*B for matrix \n"
             " A(%ix%i) and matrix B(%ix%i)\n\n", m, k, k, n);
-    DATATYPE
-    alpha = 1.0; beta = 0.0;
-
-    A = (MYFLOAT *)malloc( m*k*sizeof( MYFLOAT ));
-    B = (MYFLOAT *)malloc( k*n*sizeof( MYFLOAT ));
-    C = (MYFLOAT *)malloc( m*n*sizeof( MYFLOAT ));
-    if (A == NULL || B == NULL || C == NULL) {
-      printf( "\n ERROR: Can't allocate memory for matrices. Aborting... \n\n");
-      free(A);
-      free(B);
-      free(C);
+    if (batch > 0) {
+        printf (" in batches of %d independent products\n\n", batch);
+    }
+
+    // Without -T and -A there is one configuration, with the threads and the binding of the environment
+    if (sweeping) {
+        num_configs = sweep_configs(thread_list, binding_list, configs, SWEEP_MAX_CONFIGS);
+        if (num_configs <= 0) {
+            printf(" Wrong sweep -T %s -A %s, at most %d configurations\n", thread_list != NULL ? thread_list : "-",
+                   binding_list != NULL ? binding_list : "-", SWEEP_MAX_CONFIGS);
+            return 1;
+        }
+        if (sweep_places_init(&places) != 0) {
+            fprintf(stderr, " Unable to read the affinity of the process\n");
+            return 1;
+        }
+    }
+
+    for (int c = 0; c < num_configs; c++) {
+        const char *binding = proc_bind_name();
+        char cores[SWEEP_CORES_LENGTH], config_label[256];
+        int huge_pages = 1, placed = placement;
+
+        if (sweeping) {
+            binding = binding_names[configs[c].binding];
+            if (sweep_pin(&places, configs[c].binding, configs[c].threads) > 0) {
+                fprintf(stderr, " Unable to pin every thread\n");
+            }
+            for (int b = 0; b < num_selected; b++) {
+                set_backend_threads(selected[b], configs[c].threads);
+            }
+            printf (" Configuration %d of %d: %d threads, %s binding over %d cores \n\n", c + 1, num_configs,
+                    configs[c].threads, binding, places.count);
+        }
+
+        for (int p = 0; p < num_precisions; p++) {
+            if (precisions[p] == PREC_REFINED && batch == 0 && workspace == NULL) {
+                workspace = placed_alloc(refine_workspace_size(m, k, n), &placed, &huge_pages);
+            }
+        }
+        size_t items = batch > 0 ? batch : 1;
+        if (batch > 0) {
+            batch_arrays = malloc(3 * items * sizeof(void *));
+        }
+        int missing_workspace = 0;
+        for (int p = 0; p < num_precisions; p++) {
+            missing_workspace |= precisions[p] == PREC_REFINED && batch == 0 && workspace == NULL;
+        }
+        if ((batch > 0 && batch_arrays == NULL) || missing_workspace) {
+          printf( "\n ERROR: Can't allocate memory for matrices. Aborting... \n\n");
+          return 1;
+        }
+        if (sweep_record(sweeping ? &places : NULL, configs[c].binding, cores, sizeof(cores)) > 0) {
+            fprintf(stderr, " WARNING: threads running outside their place\n");
+        }
+        printf(" Threads on CPUs %s \n\n", cores);
+        if (label != NULL) {
+            sweep_label(config_label, sizeof(config_label), label, omp_get_max_threads());
+        }
+
+        for (int p = 0; p < num_precisions; p++) {
+            printf(" Using %s \n\n", precision_names[precisions[p]]);
+            if (batch > 0 && precisions[p] != PREC_FLOAT && precisions[p] != PREC_DOUBLE) {
+                printf(" The batched mode only supports float and double, skipped\n\n");
+                continue;
+            }
+            // Every precision gets matrices of its own size: the first touch in placed_alloc then
+            // splits them like the static loops over their elements below
+            A = placed_alloc( items*m*k*precision_sizes[precisions[p]], &placed, &huge_pages );
+            B = placed_alloc( items*k*n*precision_sizes[precisions[p]], &placed, &huge_pages );
+            C = placed_alloc( items*m*n*output_sizes[precisions[p]], &placed, &huge_pages );
+            if (A == NULL || B == NULL || C == NULL) {
+              printf( "\n ERROR: Can't allocate memory for matrices. Aborting... \n\n");
+              free(A);
+              free(B);
+              free(C);
+              return 1;
+            }
+            describe_placement(placement_description, sizeof(placement_description), placed, binding, huge_pages);
+            printf(" Matrices placed with %s \n\n", placement_description);
+            if (batch > 0) {
+                size_t size = precision_sizes[precisions[p]];
+                // Whole items per thread, in the static order of the batch loop
+#pragma omp parallel for schedule(static) if(placement != PLACE_SERIAL)
+                for (int i = 0; i < batch; i++) {
+                    batch_arrays[i] = (char *)A + i*(size_t)m*k*size;
+                    batch_arrays[batch + i] = (char *)B + i*(size_t)k*n*size;
+                    batch_arrays[2*batch + i] = (char *)C + i*(size_t)m*n*size;
+                    initialize_matrices(precisions[p], 0, batch_arrays[i], batch_arrays[batch + i], batch_arrays[2*batch + i], m, k, n);
+                }
+            } else {
+                initialize_matrices(precisions[p], placement != PLACE_SERIAL, A, B, C, m, k, n);
+            }
+
+            for (int b = 0; b < num_selected; b++) {
+                if (!supports_precision(selected[b], precisions[p])) {
+                    printf(" Backend %s has no %s gemm, skipped\n\n", selected[b]->name, precision_names[precisions[p]]);
+                    continue;
+                }
+                int tunable = precisions[p] == PREC_FLOAT || precisions[p] == PREC_DOUBLE;
+                if (tune && tunable && batch == 0 && tune_supported(selected[b])) {
+                    struct tune_entry entry;
+                    autotune(selected[b], precision_names[precisions[p]], precision_sizes[precisions[p]], m, k, n, A, B, C, &entry);
+                    tune_save(&entry);
+                    num_tune_entries = tune_load(tune_entries, TUNE_MAX_ENTRIES);
+                }
+                const struct tune_entry *tuned = tune_lookup(tune_entries, num_tune_entries, selected[b]->name, precision_names[precisions[p]], m, k, n);
+                if (tuned != NULL) {
+                    printf (" Using tuned mc %d kc %d nc %d grid %dx%d (from %dx%dx%d)\n", tuned->blocking.mc, tuned->blocking.kc,
+                            tuned->blocking.nc, tuned->blocking.tm, tuned->blocking.tn, tuned->m, tuned->k, tuned->n);
+                    tune_apply(selected[b], &tuned->blocking);
+                } else {
+                    tune_reset(selected[b]);
+                }
+                if (batch > 0) {
+                    for (int layout = 0; layout < NUM_LAYOUTS; layout++) {
+                        failures += !benchmark_batch(selected[b], precisions[p], layout, batch, m, k, n, A, B, C, batch_arrays, &options, label != NULL ? config_label : NULL, placement_description, cores);
+                    }
+                    continue;
+                }
+                printf (" Computing matrix product using %s gemm via CBLAS interface \n", selected[b]->name);
+                memset(C, 0, (size_t)m*n*output_sizes[precisions[p]]);
+                failures += !benchmark(selected[b], precisions[p], m, k, n, A, B, C, workspace, &options, label != NULL ? config_label : NULL, placement_description, cores);
+#ifdef PRINT
+                print_corners(precisions[p], m, k, n, A, B, C);
+#endif
+            }
+            free(A);
+            free(B);
+            free(C);
+        }
+
+        free(batch_arrays);
+        free(workspace);
+        batch_arrays = NULL;
+        workspace = NULL;
+    }
+
+    if (failures > 0) {
+      printf("\n ERROR: %d products failed verification\n\n", failures);
       return 1;
     }
+    return 0;
+}
+
+// Returns the number of precisions parsed, -1 on an unknown name
+int parse_precisions(const char *list, int *precisions) {
+    char buffer[256];
+    int count = 0;
 
-    for (i = 0; i < (m*k); i++) {
-        A[i] = (MYFLOAT)(i+1);
+    strncpy(buffer, list, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    for (char *name = strtok(buffer, ","); name != NULL; name = strtok(NULL, ",")) {
+        int found = -1;
+        for (int p = 0; p < NUM_PRECISIONS; p++) {
+            if (strcmp(name, precision_names[p]) == 0) {
+                found = p;
+            }
+        }
+        if (found < 0 || count == NUM_PRECISIONS) {
+            printf(" Unknown precision %s\n", name);
+            return -1;
+        }
+        precisions[count++] = found;
     }
+    return count;
+}
 
-    for (i = 0; i < (k*n); i++) {
-        B[i] = (MYFLOAT)(-i-1);
+// Returns the number of backends that could be loaded, unknown or missing backends are skipped
+int parse_backends(const char *list, struct gemm_backend **selected) {
+    char buffer[256];
+    int count = 0;
+
+    strncpy(buffer, list, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
+    for (char *name = strtok(buffer, ","); name != NULL && count < MAX_BACKENDS; name = strtok(NULL, ",")) {
+        struct gemm_backend *backend = find_backend(name);
+        if (backend == NULL) {
+            printf(" Unknown backend %s\n", name);
+            continue;
+        }
+        if (load_backend(backend) == 0) {
+            selected[count++] = backend;
+        }
+    }
+    return count;
+}
+
+// Static chunks, so every thread writes the pages it first touched in placed_alloc
+void initialize_matrices(int precision, int parallel, void *A, void *B, void *C, int m, int k, int n) {
+    long i;
+#pragma omp parallel if(parallel)
+    {
+#pragma omp for schedule(static)
+        for (i = 0; i < (long)m*k; i++) store_entry(precision, A, i, a_entry(i));
+#pragma omp for schedule(static)
+        for (i = 0; i < (long)k*n; i++) store_entry(precision, B, i, b_entry(i));
+#pragma omp for schedule(static)
+        for (i = 0; i < (long)m*n; i++) {
+            if (output_sizes[precision] == sizeof(float)) ((float *)C)[i] = 0.0;
+            else ((double *)C)[i] = 0.0;
+        }
     }
+}
+
+int supports_precision(struct gemm_backend *backend, int precision) {
+    switch (precision) {
+        case PREC_BF16:
+            return backend->bf16gemm != NULL;
+        case PREC_FP16:
+            return backend->fp16gemm != NULL;
+        default:
+            return 1;
+    }
+}
 
-    for (i = 0; i < (m*n); i++) {
-        C[i] = 0.0;
+void run_gemm(struct gemm_backend *backend, int precision, int m, int k, int n, void *A, void *B, void *C, void *workspace) {
+    switch (precision) {
+        case PREC_FLOAT:
+            backend->sgemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS,
+                           m, n, k, 1.0f, A, m, B, k, 0.0f, C, m);
+            break;
+        case PREC_DOUBLE:
+            backend->dgemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS,
+                           m, n, k, 1.0, A, m, B, k, 0.0, C, m);
+            break;
+        case PREC_BF16:
+            backend->bf16gemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS,
+                              m, n, k, 1.0f, A, m, B, k, 0.0f, C, m);
+            break;
+        case PREC_FP16:
+            backend->fp16gemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS,
+                              m, n, k, 1.0f, A, m, B, k, 0.0f, C, m);
+            break;
+        case PREC_REFINED:
+            refined_gemm(backend, m, k, n, A, B, C, workspace);
+            break;
     }
+}
+
+void run_gemm_call(void *argument) {
+    struct gemm_call *call = argument;
+    run_gemm(call->backend, call->precision, call->m, call->k, call->n, call->A, call->B, call->C, call->workspace);
+}
+
+int benchmark(struct gemm_backend *backend, int precision, int m, int k, int n, void *A, void *B, void *C, void *workspace, const struct bench_options *options, const char *label, const char *placement, const char *cores) {
+    struct gemm_call call = {backend, precision, m, k, n, A, B, C, workspace};
+    struct bench_result r;
 
-    sleep(1);
-    printf (" Computing matrix product using gemm function via CBLAS interface \n");
+    struct verify_result check;
 
-   #ifdef MULTIPLE_ITERATIONS
-    double elapsed_sum = 0.0, elapsed_sq_sum = 0.0;
-    double gflops_sum = 0.0, gflops_sq_sum = 0.0;
-    int num_trials = 30;
-    for (int trial=0; trial < num_trials; trial++){
-   	 clock_gettime(CLOCK_MONOTONIC, &begin);
-   	 GEMMCPU(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                m, n, k, alpha, A, m, B, k, beta, C, m);
-   	 clock_gettime(CLOCK_MONOTONIC, &end);
-  	 elapsed = (double)diff(begin,end).tv_sec + (double)diff(begin,end).tv_nsec / 1000000000.0;
-  	 double gflops = 2.0 * m *n*k;
-   	 gflops = gflops/elapsed*1.0e-9; 
-	 elapsed_sum += elapsed;
-         elapsed_sq_sum += elapsed * elapsed;
-         gflops_sum += gflops;
-         gflops_sq_sum += gflops * gflops;
+    bench_run(run_gemm_call, &call, 2.0 * m * n * k, options, &r);
+    double error = max_relative_error(precision, m, k, n, C);
+    freivalds_check(precision, m, k, n, A, B, C, &check);
+    if (!check.passed) {
+      fprintf(stderr, " WARNING: %s %s gemm failed verification, residual %.3e above %.3e\n",
+              backend->name, precision_names[precision], check.residual, check.tolerance);
     }
-    double elapsed_mean = elapsed_sum / num_trials;
-    double elapsed_sd = sqrt((elapsed_sq_sum / num_trials) - (elapsed_mean * elapsed_mean));
-    double gflops_mean = gflops_sum / num_trials;
-    double gflops_sd = sqrt((gflops_sq_sum / num_trials) - (gflops_mean * gflops_mean));
-    #ifdef WRITE_CSV
+
+    if (label != NULL) {
+      char filename[256];
+      sprintf(filename, "%s_%s.csv", backend->name, precision_names[precision]);
       FILE* results;
-      results = fopen(RESULTS, "a");
-      fprintf(results, "%lf,%lf,%lf,%lf\n", elapsed_mean, elapsed_sd, gflops_mean, gflops_sd);
+      results = fopen(filename, "a");
+      fprintf(results, "%s,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%d,%s,%.3e,%.3e,%s,%d,%s\n", label, r.time_mean, r.time_sd, r.gflops_mean, r.gflops_sd,
+              r.time_min, r.time_p10, r.time_median, r.time_p90, r.gflops_median, r.trials, placement, error,
+              check.residual, check.passed ? "ok" : "FAILED", omp_get_max_threads(), cores);
       fclose(results);
-    #else 
-      printf("\n Elapsed time mean: %lf s, standard deviation: %lf s\n", elapsed_mean, elapsed_sd);
-      printf("%dx%dx%d\t%lf GFLOPS mean, %lf GFLOPS standard deviation\n", m, n, k, gflops_mean, gflops_sd);
-    #endif
-   #else
-    clock_gettime(CLOCK_MONOTONIC, &begin);
-    GEMMCPU(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                m, n, k, alpha, A, m, B, k, beta, C, m);
-    clock_gettime(CLOCK_MONOTONIC, &end);
-    elapsed = (double)diff(begin,end).tv_sec + (double)diff(begin,end).tv_nsec / 1000000000.0;
-    double gflops = 2.0 * m *n*k;
-    gflops = gflops/elapsed*1.0e-9;
-   #ifdef WRITE_CSV
-    FILE* results;
-    results = fopen(RESULTS, "a"); 
-    fprintf(results, "%lf,%lf\n",  elapsed, gflops);
-    fclose(results);
-   #else 
-    printf ("\n Elapsed time %d.%d s\n\n\n", diff(begin,end).tv_sec, diff(begin,end).tv_nsec );
-    printf("%dx%d\t%lf s\t%lf GFLOPS\n", n, k, elapsed, gflops);
-   #endif
-  #endif
+    } else {
+      printf("\n Elapsed time mean: %lf s, standard deviation: %lf s over %d trials\n", r.time_mean, r.time_sd, r.trials);
+      printf(" Elapsed time min: %lf s, p10: %lf s, median: %lf s, p90: %lf s\n", r.time_min, r.time_p10, r.time_median, r.time_p90);
+      printf("%dx%dx%d\t%lf GFLOPS mean, %lf GFLOPS standard deviation, %lf GFLOPS median\n", m, n, k, r.gflops_mean, r.gflops_sd, r.gflops_median);
+      printf(" Max relative error: %.3e\n", error);
+      printf(" Freivalds residual: %.3e (tolerance %.3e), %s\n\n", check.residual, check.tolerance, check.passed ? "verified" : "FAILED");
+    }
+    return check.passed;
+}
 
-#ifdef PRINT
+// Results go to <backend>_<precision>_batch.csv, the GFLOPS are aggregated over the whole batch
+int benchmark_batch(struct gemm_backend *backend, int precision, int layout, int count, int m, int k, int n, void *A, void *B, void *C, void **arrays, const struct bench_options *options, const char *label, const char *placement, const char *cores) {
+    size_t size = precision_sizes[precision];
+    struct gemm_batch call = {backend, size, layout, count, m, k, n, A, B, C, arrays, arrays + count, arrays + 2*count,
+                              batch_api(backend, size, layout)};
+    const char *api = call.api != NULL ? "library" : "openmp";
+    struct bench_result r;
+
+    struct verify_result check;
+    int passed = 1;
+
+    printf (" Computing %d %s products using %s gemm (%s batch) \n", count, batch_layout_names[layout], backend->name, api);
+    memset(C, 0, (size_t)count*m*n*size);
+    bench_run(run_gemm_batch, &call, 2.0 * m * n * k * count, options, &r);
+    // The first and the last product catch wrong strides and items left out
+    for (int i = 0; i < count; i += count > 1 ? count - 1 : 1) {
+        freivalds_check(precision, m, k, n, (char *)A + i*(size_t)m*k*size, (char *)B + i*(size_t)k*n*size,
+                        (char *)C + i*(size_t)m*n*size, &check);
+        if (!check.passed) {
+            fprintf(stderr, " WARNING: %s %s batch product %d failed verification, residual %.3e above %.3e\n",
+                    backend->name, precision_names[precision], i, check.residual, check.tolerance);
+            passed = 0;
+        }
+    }
+
+    if (label != NULL) {
+      char filename[256];
+      sprintf(filename, "%s_%s_batch.csv", backend->name, precision_names[precision]);
+      FILE* results;
+      results = fopen(filename, "a");
+      fprintf(results, "%s,%s,%s,%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%d,%s,%s,%d,%s\n", label, batch_layout_names[layout], api, count,
+              r.time_mean, r.time_sd, r.gflops_mean, r.gflops_sd, r.time_min, r.time_p10, r.time_median, r.time_p90,
+              r.gflops_median, r.trials, placement, passed ? "ok" : "FAILED", omp_get_max_threads(), cores);
+      fclose(results);
+    } else {
+      printf("\n Elapsed time mean: %lf s, standard deviation: %lf s over %d trials\n", r.time_mean, r.time_sd, r.trials);
+      printf("%d x %dx%dx%d\t%lf GFLOPS mean, %lf GFLOPS standard deviation, %lf GFLOPS median\n", count, m, n, k, r.gflops_mean, r.gflops_sd, r.gflops_median);
+      printf(" %s\n\n", passed ? "Verified" : "Verification FAILED");
+    }
+    return passed;
+}
+
+void print_corners(int precision, int m, int k, int n, void *A, void *B, void *C) {
+    int i, j;
+#define ELEMENT(X, idx) ((X) == C ? load_output(precision, C, idx) : load_entry(precision, X, idx))
     printf (" Top left corner of matrix A: \n");
     for (i=0; i<min(m,6); i++) {
       for (j=0; j<min(k,6); j++) {
-        printf ("%12.0f", A[j+i*k]);
+        printf ("%12.5G", ELEMENT(A, i+j*m));
       }
       printf ("\n");
     }
@@ -191,22 +519,145 @@ int main(int argc, char** argv)
     printf ("\n Top left corner of matrix B: \n");
     for (i=0; i<min(k,6); i++) {
       for (j=0; j<min(n,6); j++) {
-        printf ("%12.0f", B[j+i*n]);
+        printf ("%12.5G", ELEMENT(B, i+j*k));
       }
       printf ("\n");
     }
-    
+
     printf ("\n Top left corner of matrix C: \n");
     for (i=0; i<min(m,6); i++) {
       for (j=0; j<min(n,6); j++) {
-        printf ("%12.5G", C[j+i*n]);
+        printf ("%12.5G", ELEMENT(C, i+j*m));
       }
       printf ("\n");
     }
-#endif
-    free(A);
-    free(B);
-    free(C);
+#undef ELEMENT
+}
 
-    return 0;
+#ifdef WITH_MPI
+// Every return from main goes through here
+void finalize_mpi() {
+    MPI_Finalize();
+}
+
+// SUMMA over all the ranks, see summa.h. Only rank 0 prints and writes the results.
+int run_distributed(struct gemm_backend **selected, int num_selected, const int *precisions, int num_precisions, int m, int k, int n, struct bench_options *options, const struct tune_entry *tune_entries, int num_tune_entries, const char *label, int placement) {
+    struct summa_grid grid;
+    struct summa_call call;
+    char placement_description[64];
+    int failures = 0;
+
+    summa_grid_create(&grid, m, k, n);
+    if (grid.rank == 0) {
+      printf ("\n Distributed matrix product C=A*B for matrix A(%ix%i) and matrix B(%ix%i) \n"
+              " on a %dx%d grid of ranks over %d nodes, %d threads per rank \n\n", m, k, k, n,
+              grid.rows, grid.columns, grid.nodes, omp_get_max_threads());
+    }
+    if (options->confidence > 0) {
+      // Every rank has to run the same number of trials
+      if (grid.rank == 0) {
+        printf (" -r is ignored with MPI, %d trials \n\n", options->trials);
+      }
+      options->confidence = 0;
+    }
+
+    for (int p = 0; p < num_precisions; p++) {
+        int huge_pages = 1, placed = placement;
+        if (grid.rank == 0) {
+          printf(" Using %s \n\n", precision_names[precisions[p]]);
+        }
+        if (precisions[p] == PREC_REFINED) {
+            if (grid.rank == 0) {
+              printf(" float-refined is not distributed, skipped\n\n");
+            }
+            continue;
+        }
+        if (!summa_setup(&call, &grid, precisions[p], m, k, n, &placed, &huge_pages)) {
+            fprintf(stderr, "\n ERROR: Can't allocate memory for the blocks on rank %d. Aborting... \n\n", grid.rank);
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        // Only interleave can fall back, to first-touch, the lowest policy: one rank is enough
+        MPI_Allreduce(MPI_IN_PLACE, &huge_pages, 1, MPI_INT, MPI_MIN, grid.comm);
+        MPI_Allreduce(MPI_IN_PLACE, &placed, 1, MPI_INT, MPI_MIN, grid.comm);
+        describe_placement(placement_description, sizeof(placement_description), placed, proc_bind_name(), huge_pages);
+        summa_initialize(&call, placement != PLACE_SERIAL);
+
+        for (int b = 0; b < num_selected; b++) {
+            if (!supports_precision(selected[b], precisions[p])) {
+                if (grid.rank == 0) {
+                  printf(" Backend %s has no %s gemm, skipped\n\n", selected[b]->name, precision_names[precisions[p]]);
+                }
+                continue;
+            }
+            // The local products are local_m x panel x local_n
+            const struct tune_entry *tuned = tune_lookup(tune_entries, num_tune_entries, selected[b]->name, precision_names[precisions[p]],
+                                                         call.local_m, call.panel, call.local_n);
+            if (tuned != NULL) {
+                tune_apply(selected[b], &tuned->blocking);
+            } else {
+                tune_reset(selected[b]);
+            }
+            call.backend = selected[b];
+            failures += !benchmark_summa(&call, options, label, placement_description);
+        }
+        summa_free(&call);
+    }
+
+    if (failures > 0 && grid.rank == 0) {
+      printf("\n ERROR: %d products failed verification\n\n", failures);
+    }
+    summa_grid_free(&grid);
+    return failures > 0;
 }
+
+// Results go to <backend>_<precision>_summa.csv. Aggregate GFLOPS count the whole product, the
+// GFLOPS of a node count the products of its ranks' C blocks over the time of its slowest rank,
+// the slowest and fastest node are kept.
+int benchmark_summa(struct summa_call *call, const struct bench_options *options, const char *label, const char *placement) {
+    struct summa_grid *grid = call->grid;
+    struct bench_result r;
+    struct verify_result check;
+    double error, node_flops, node_time, node_min, node_max;
+    double flops = 2.0 * call->local_m * call->local_n * call->k;
+
+    if (grid->rank == 0) {
+      printf (" Computing matrix product using %s gemm with SUMMA, panels of %d \n", call->backend->name, call->panel);
+    }
+    memset(call->C, 0, (size_t)call->local_m * call->local_n * output_sizes[call->precision]);
+    bench_run(run_summa_call, call, 2.0 * call->m * call->n * call->k, options, &r);
+    summa_verify(call, &error, &check);
+
+    MPI_Allreduce(&flops, &node_flops, 1, MPI_DOUBLE, MPI_SUM, grid->node);
+    MPI_Allreduce(&r.time_mean, &node_time, 1, MPI_DOUBLE, MPI_MAX, grid->node);
+    node_flops *= 1.0e-9 / node_time;
+    MPI_Allreduce(&node_flops, &node_min, 1, MPI_DOUBLE, MPI_MIN, grid->comm);
+    MPI_Allreduce(&node_flops, &node_max, 1, MPI_DOUBLE, MPI_MAX, grid->comm);
+    if (grid->rank != 0) {
+      return check.passed;
+    }
+
+    if (!check.passed) {
+      fprintf(stderr, " WARNING: %s %s SUMMA failed verification, residual %.3e above %.3e\n",
+              call->backend->name, precision_names[call->precision], check.residual, check.tolerance);
+    }
+    if (label != NULL) {
+      char filename[256];
+      sprintf(filename, "%s_%s_summa.csv", call->backend->name, precision_names[call->precision]);
+      FILE* results;
+      results = fopen(filename, "a");
+      fprintf(results, "%s,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%d,%s,%dx%d,%d,%d,%d,%lf,%lf,%.3e,%.3e,%s\n", label,
+              r.time_mean, r.time_sd, r.gflops_mean, r.gflops_sd, r.time_min, r.time_p10, r.time_median, r.time_p90,
+              r.gflops_median, r.trials, placement, grid->rows, grid->columns, grid->size, grid->nodes, omp_get_max_threads(),
+              node_min, node_max, error, check.residual, check.passed ? "ok" : "FAILED");
+      fclose(results);
+    } else {
+      printf("\n Elapsed time mean: %lf s, standard deviation: %lf s over %d trials\n", r.time_mean, r.time_sd, r.trials);
+      printf(" Elapsed time min: %lf s, p10: %lf s, median: %lf s, p90: %lf s\n", r.time_min, r.time_p10, r.time_median, r.time_p90);
+      printf("%dx%dx%d\t%lf GFLOPS mean, %lf GFLOPS standard deviation, %lf GFLOPS median\n", call->m, call->n, call->k, r.gflops_mean, r.gflops_sd, r.gflops_median);
+      printf(" Per node: %lf GFLOPS slowest, %lf GFLOPS fastest over %d nodes\n", node_min, node_max, grid->nodes);
+      printf(" Max relative error: %.3e\n", error);
+      printf(" Freivalds residual: %.3e (tolerance %.3e), %s\n\n", check.residual, check.tolerance, check.passed ? "verified" : "FAILED");
+    }
+    return check.passed;
+}
+#endif
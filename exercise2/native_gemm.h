@@ -0,0 +1,370 @@
+#include <immintrin.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Native GEMM in the GotoBLAS/BLIS style, column major and no transposition (what the driver times).
+//
+//   for jc in N by NC                      B panel  (KC x NC) packed once, shared by all threads
+//     for pc in K by KC
+//       for ic in M by MC   (thread rows)  A block  (MC x KC) packed by each thread, stays in L2
+//         for jr in NC by NR (thread cols)
+//           for ir in MC by MR             micro-kernel: MR x NR block of C in registers
+//
+// The micro-kernels are written with GCC vector extensions and compiled for AVX-512 and AVX2+FMA
+// through target attributes; the widest one the CPU supports is picked at the first call.
+// bf16 and fp16 are widened to fp32 while they are packed (bf16 can run on vdpbf16ps instead, see
+// native_has_bf16), accumulation is always fp32.
+
+#define NATIVE_ALIGNMENT 64
+#define NATIVE_MAX_MR 48
+#define NATIVE_MAX_NR 8
+
+// Block sizes and thread grid, zero fields are replaced with the defaults of the selected kernel
+struct gemm_blocking {
+    int mc, kc, nc;
+    int tm, tn;      // threads along M and along N, tm * tn threads in total
+};
+
+struct gemm_blocking native_blocking = {0};
+
+enum native_isa { NATIVE_GENERIC, NATIVE_AVX2, NATIVE_AVX512 };
+const char *native_isa_names[] = {"generic", "avx2", "avx512"};
+
+int native_select_isa();
+int native_has_bf16();
+void native_register_block(int isa, size_t type_size, int *mr, int *nr);
+void native_default_blocking(int isa, size_t type_size, int m, int n, struct gemm_blocking *blocking);
+void native_sgemm(int order, int transa, int transb, int m, int n, int k, float alpha, const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc);
+void native_dgemm(int order, int transa, int transb, int m, int n, int k, double alpha, const double *A, int lda, const double *B, int ldb, double beta, double *C, int ldc);
+
+// The ISA can be forced with GEMM_NATIVE_ISA=generic|avx2|avx512, e.g. to compare the kernels
+int native_select_isa() {
+    static int isa = -1;
+    if (isa >= 0) {
+        return isa;
+    }
+
+    const char *forced = getenv("GEMM_NATIVE_ISA");
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        isa = NATIVE_AVX512;
+    } else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        isa = NATIVE_AVX2;
+    } else {
+        isa = NATIVE_GENERIC;
+    }
+    for (int i = 0; forced != NULL && i < isa; i++) {
+        if (strcmp(forced, native_isa_names[i]) == 0) {
+            isa = i;
+        }
+    }
+    return isa;
+}
+
+// Registers: AVX-512 keeps 3 x 8 zmm accumulators, AVX2 keeps 2 x 6 ymm accumulators
+void native_register_block(int isa, size_t type_size, int *mr, int *nr) {
+    int lanes = isa == NATIVE_AVX512 ? 64 / (int)type_size : 32 / (int)type_size;
+    switch (isa) {
+        case NATIVE_AVX512:
+            *mr = 3 * lanes;
+            *nr = 8;
+            break;
+        case NATIVE_AVX2:
+            *mr = 2 * lanes;
+            *nr = 6;
+            break;
+        default:
+            *mr = 4;
+            *nr = 4;
+    }
+}
+
+// A block of MC x KC elements for L2, a B panel of KC x NC elements for L3.
+// The thread grid splits M first, N only gets threads when M has too few MC blocks.
+void native_default_blocking(int isa, size_t type_size, int m, int n, struct gemm_blocking *blocking) {
+    int mr, nr;
+    native_register_block(isa, type_size, &mr, &nr);
+
+    if (blocking->kc <= 0) blocking->kc = type_size == sizeof(double) ? 256 : 384;
+    if (blocking->mc <= 0) blocking->mc = (isa == NATIVE_AVX512 ? 4 : 9) * mr;
+    if (blocking->nc <= 0) blocking->nc = 4080;
+    blocking->mc = (blocking->mc + mr - 1) / mr * mr;
+    blocking->nc = (blocking->nc + nr - 1) / nr * nr;
+
+    // Called from inside a parallel region (e.g. a batch of products) the grid is a single thread
+    int threads = omp_get_active_level() >= omp_get_max_active_levels() ? 1 : omp_get_max_threads();
+    if (blocking->tm <= 0 || blocking->tn <= 0 || blocking->tm * blocking->tn != threads) {
+        int m_blocks = (m + blocking->mc - 1) / blocking->mc;
+        blocking->tm = threads;
+        while (blocking->tm > 1 && (blocking->tm > m_blocks || threads % blocking->tm != 0)) {
+            blocking->tm--;
+        }
+        blocking->tn = threads / blocking->tm;
+    }
+}
+
+#define NATIVE_KERNEL(NAME, TYPE, LANES, MR, NR, TARGET)                                             \
+__attribute__((target(TARGET))) void NAME(int kc, const TYPE *restrict a, const TYPE *restrict b,     \
+                                          TYPE *restrict c, long ldc, TYPE alpha, TYPE beta) {        \
+    typedef TYPE vec __attribute__((vector_size(LANES * sizeof(TYPE))));                             \
+    typedef TYPE uvec __attribute__((vector_size(LANES * sizeof(TYPE)), aligned(sizeof(TYPE))));     \
+    vec acc[MR / LANES][NR];                                                                          \
+    _Pragma("GCC unroll 8")                                                                           \
+    for (int j = 0; j < NR; j++) {                                                                    \
+        _Pragma("GCC unroll 4")                                                                       \
+        for (int v = 0; v < MR / LANES; v++) acc[v][j] = (vec){0};                                    \
+    }                                                                                                 \
+    for (int p = 0; p < kc; p++) {                                                                    \
+        vec av[MR / LANES];                                                                           \
+        _Pragma("GCC unroll 4")                                                                       \
+        for (int v = 0; v < MR / LANES; v++) av[v] = *(const vec *)(a + p * MR + v * LANES);          \
+        _Pragma("GCC unroll 8")                                                                       \
+        for (int j = 0; j < NR; j++) {                                                                \
+            TYPE bj = b[p * NR + j];                                                                  \
+            _Pragma("GCC unroll 4")                                                                   \
+            for (int v = 0; v < MR / LANES; v++) acc[v][j] += av[v] * bj;                             \
+        }                                                                                             \
+    }                                                                                                 \
+    _Pragma("GCC unroll 8")                                                                           \
+    for (int j = 0; j < NR; j++) {                                                                    \
+        _Pragma("GCC unroll 4")                                                                       \
+        for (int v = 0; v < MR / LANES; v++) {                                                        \
+            uvec *cv = (uvec *)(c + j * ldc + v * LANES);                                             \
+            *cv = beta == 0 ? alpha * acc[v][j] : alpha * acc[v][j] + beta * *cv;                     \
+        }                                                                                             \
+    }                                                                                                 \
+}
+
+NATIVE_KERNEL(native_dkernel_avx512, double, 8, 24, 8, "avx512f")
+NATIVE_KERNEL(native_skernel_avx512, float, 16, 48, 8, "avx512f")
+NATIVE_KERNEL(native_dkernel_avx2, double, 4, 8, 6, "avx2,fma")
+NATIVE_KERNEL(native_skernel_avx2, float, 8, 16, 6, "avx2,fma")
+
+// AVX-512 BF16: vdpbf16ps multiplies pairs of bf16 and accumulates both products into one fp32 lane,
+// so the operands are packed in pairs along K, (A[i][p], A[i][p+1]) and (B[p][j], B[p+1][j]).
+__attribute__((target("avx512f,avx512bf16"))) void native_bf16kernel_avx512(int kc, const gemm_bf16 *restrict a,
+        const gemm_bf16 *restrict b, float *restrict c, long ldc, float alpha, float beta) {
+    __m512 acc[3][8];
+#pragma GCC unroll 8
+    for (int j = 0; j < 8; j++)
+#pragma GCC unroll 3
+        for (int v = 0; v < 3; v++) acc[v][j] = _mm512_setzero_ps();
+    for (int p = 0; p < kc; p += 2) {
+        __m512bh av[3];
+#pragma GCC unroll 3
+        for (int v = 0; v < 3; v++) av[v] = (__m512bh)_mm512_loadu_si512(a + p * 48 + v * 32);
+#pragma GCC unroll 8
+        for (int j = 0; j < 8; j++) {
+            int pair;
+            memcpy(&pair, b + p * 8 + j * 2, sizeof(pair));
+            __m512bh bj = (__m512bh)_mm512_set1_epi32(pair);
+#pragma GCC unroll 3
+            for (int v = 0; v < 3; v++) acc[v][j] = _mm512_dpbf16_ps(acc[v][j], av[v], bj);
+        }
+    }
+#pragma GCC unroll 8
+    for (int j = 0; j < 8; j++) {
+#pragma GCC unroll 3
+        for (int v = 0; v < 3; v++) {
+            float *cv = c + j * ldc + v * 16;
+            __m512 r = _mm512_mul_ps(_mm512_set1_ps(alpha), acc[v][j]);
+            if (beta != 0) r = _mm512_fmadd_ps(_mm512_set1_ps(beta), _mm512_loadu_ps(cv), r);
+            _mm512_storeu_ps(cv, r);
+        }
+    }
+}
+
+#define NATIVE_GENERIC_KERNEL(NAME, TYPE)                                                            \
+void NAME(int kc, const TYPE *restrict a, const TYPE *restrict b, TYPE *restrict c,                  \
+          long ldc, TYPE alpha, TYPE beta) {                                                         \
+    TYPE acc[4][4] = {{0}};                                                                          \
+    for (int p = 0; p < kc; p++)                                                                     \
+        for (int j = 0; j < 4; j++)                                                                  \
+            for (int i = 0; i < 4; i++) acc[j][i] += a[p * 4 + i] * b[p * 4 + j];                   \
+    for (int j = 0; j < 4; j++)                                                                      \
+        for (int i = 0; i < 4; i++)                                                                  \
+            c[i + j * ldc] = beta == 0 ? alpha * acc[j][i] : alpha * acc[j][i] + beta * c[i + j * ldc]; \
+}
+
+NATIVE_GENERIC_KERNEL(native_skernel_generic, float)
+NATIVE_GENERIC_KERNEL(native_dkernel_generic, double)
+
+// Instantiate the packing routines and the blocked loops for one precision.
+// A and B are stored as IN_TYPE and widened by LOAD while they are packed into PACKED elements;
+// GROUP consecutive K values of a row (column) of A (B) are kept together for the kernels that
+// consume them as a unit. C is TYPE, KERNEL selects the micro-kernel for the ISA.
+#define NATIVE_GEMM(PREFIX, TYPE, IN_TYPE, PACKED, LOAD, GROUP, KERNEL)                              \
+                                                                                                     \
+/* MR-row micro-panels of the mc x kc block of A, zero padded */                                     \
+void PREFIX##pack_a(int mc, int kc, const IN_TYPE *A, long lda, PACKED *packed, int mr) {            \
+    int kc_padded = (kc + GROUP - 1) / GROUP * GROUP;                                                \
+    for (int ir = 0; ir < mc; ir += mr) {                                                            \
+        int rows = mc - ir < mr ? mc - ir : mr;                                                      \
+        for (int p = 0; p < kc_padded; p += GROUP) {                                                 \
+            for (int i = 0; i < mr; i++)                                                             \
+                for (int g = 0; g < GROUP; g++)                                                      \
+                    *packed++ = i < rows && p + g < kc ? LOAD(A[ir + i + (p + g) * lda]) : 0;        \
+        }                                                                                            \
+    }                                                                                                \
+}                                                                                                    \
+                                                                                                     \
+/* NR-column micro-panels of the kc x nc panel of B, zero padded, split among the threads */         \
+void PREFIX##pack_b(int kc, int nc, const IN_TYPE *B, long ldb, PACKED *packed, int nr) {            \
+    int kc_padded = (kc + GROUP - 1) / GROUP * GROUP;                                                \
+    int panels = (nc + nr - 1) / nr;                                                                 \
+    _Pragma("omp for schedule(static)")                                                              \
+    for (int jp = 0; jp < panels; jp++) {                                                            \
+        int jr = jp * nr;                                                                            \
+        int cols = nc - jr < nr ? nc - jr : nr;                                                      \
+        PACKED *b = packed + (long)jp * nr * kc_padded;                                              \
+        for (int p = 0; p < kc_padded; p += GROUP) {                                                 \
+            for (int j = 0; j < nr; j++)                                                             \
+                for (int g = 0; g < GROUP; g++)                                                      \
+                    *b++ = j < cols && p + g < kc ? LOAD(B[p + g + (long)(jr + j) * ldb]) : 0;       \
+        }                                                                                            \
+    }                                                                                                \
+}                                                                                                    \
+                                                                                                     \
+void PREFIX##gemm_blocked(int m, int n, int k, TYPE alpha, const IN_TYPE *A, long lda,               \
+                          const IN_TYPE *B, long ldb, TYPE beta, TYPE *C, long ldc,                  \
+                          const struct gemm_blocking *user) {                                        \
+    int isa = native_select_isa();                                                                   \
+    int mr, nr;                                                                                      \
+    struct gemm_blocking blk = *user;                                                                \
+    void (*kernel)(int, const PACKED *, const PACKED *, TYPE *, long, TYPE, TYPE) = KERNEL(isa);     \
+                                                                                                     \
+    native_register_block(isa, sizeof(TYPE), &mr, &nr);                                              \
+    native_default_blocking(isa, sizeof(TYPE), m, n, &blk);                                          \
+    blk.kc = (blk.kc + GROUP - 1) / GROUP * GROUP;                                                   \
+                                                                                                     \
+    int kc_max = k < blk.kc ? (k + GROUP - 1) / GROUP * GROUP : blk.kc;                              \
+    int nc_max = (n < blk.nc ? (n + nr - 1) / nr * nr : blk.nc);                                     \
+    PACKED *packed_b = aligned_alloc(NATIVE_ALIGNMENT,                                               \
+                                     ((size_t)kc_max * nc_max * sizeof(PACKED) + NATIVE_ALIGNMENT - 1) \
+                                     / NATIVE_ALIGNMENT * NATIVE_ALIGNMENT);                         \
+    int failed = packed_b == NULL;                                                                   \
+                                                                                                     \
+    /* A smaller team than asked for (OMP_DYNAMIC, thread limits, nesting) splits the rows only */   \
+    _Pragma("omp parallel num_threads(blk.tm * blk.tn) if(!failed)")                                 \
+    {                                                                                                \
+        int tid = omp_get_thread_num(), team = omp_get_num_threads();                                \
+        int tm = team == blk.tm * blk.tn ? blk.tm : team, tn = team == blk.tm * blk.tn ? blk.tn : 1; \
+        int ty = tid % tm, tx = tid / tm;                                                            \
+        TYPE c_edge[NATIVE_MAX_MR * NATIVE_MAX_NR] __attribute__((aligned(NATIVE_ALIGNMENT)));       \
+        PACKED *packed_a = aligned_alloc(NATIVE_ALIGNMENT,                                           \
+                                         ((size_t)blk.mc * kc_max * sizeof(PACKED) + NATIVE_ALIGNMENT - 1) \
+                                         / NATIVE_ALIGNMENT * NATIVE_ALIGNMENT);                     \
+        if (packed_a == NULL) {                                                                      \
+            _Pragma("omp atomic write")                                                              \
+            failed = 1;                                                                              \
+        }                                                                                            \
+        _Pragma("omp barrier")                                                                       \
+                                                                                                     \
+        for (int jc = 0; jc < n && !failed; jc += blk.nc) {                                          \
+            int nc = n - jc < blk.nc ? n - jc : blk.nc;                                              \
+            int panels = (nc + nr - 1) / nr;                                                         \
+            int first_panel = panels * tx / tn, last_panel = panels * (tx + 1) / tn;                 \
+                                                                                                     \
+            for (int pc = 0; pc < k; pc += blk.kc) {                                                 \
+                int kc = k - pc < blk.kc ? k - pc : blk.kc;                                          \
+                int kc_padded = (kc + GROUP - 1) / GROUP * GROUP;                                    \
+                TYPE beta_pc = pc == 0 ? beta : 1;                                                   \
+                                                                                                     \
+                _Pragma("omp barrier")                                                               \
+                PREFIX##pack_b(kc, nc, B + pc + (long)jc * ldb, ldb, packed_b, nr);                  \
+                                                                                                     \
+                for (int ic = ty * blk.mc; ic < m; ic += tm * blk.mc) {                              \
+                    int mc = m - ic < blk.mc ? m - ic : blk.mc;                                      \
+                    PREFIX##pack_a(mc, kc, A + ic + (long)pc * lda, lda, packed_a, mr);              \
+                                                                                                     \
+                    for (int jp = first_panel; jp < last_panel; jp++) {                              \
+                        int jr = jp * nr;                                                            \
+                        int cols = nc - jr < nr ? nc - jr : nr;                                      \
+                        for (int ir = 0; ir < mc; ir += mr) {                                        \
+                            int rows = mc - ir < mr ? mc - ir : mr;                                  \
+                            const PACKED *a = packed_a + (long)ir * kc_padded;                       \
+                            const PACKED *b = packed_b + (long)jr * kc_padded;                       \
+                            TYPE *c = C + ic + ir + (long)(jc + jr) * ldc;                           \
+                            if (rows == mr && cols == nr) {                                          \
+                                kernel(kc_padded, a, b, c, ldc, alpha, beta_pc);                     \
+                            } else {                                                                 \
+                                kernel(kc_padded, a, b, c_edge, mr, 1, 0);                           \
+                                for (int j = 0; j < cols; j++)                                       \
+                                    for (int i = 0; i < rows; i++)                                   \
+                                        c[i + j * ldc] = beta_pc == 0 ? alpha * c_edge[i + j * mr]   \
+                                            : alpha * c_edge[i + j * mr] + beta_pc * c[i + j * ldc]; \
+                            }                                                                        \
+                        }                                                                            \
+                    }                                                                                \
+                }                                                                                    \
+            }                                                                                        \
+        }                                                                                            \
+        free(packed_a);                                                                              \
+    }                                                                                                \
+    free(packed_b);                                                                                  \
+    if (failed) {                                                                                    \
+        fprintf(stderr, " Native gemm: unable to allocate the packing buffers, C is not computed\n"); \
+    }                                                                                                \
+}
+
+#define NATIVE_SKERNEL(isa) (isa == NATIVE_AVX512 ? native_skernel_avx512 \
+                             : isa == NATIVE_AVX2 ? native_skernel_avx2 : native_skernel_generic)
+#define NATIVE_DKERNEL(isa) (isa == NATIVE_AVX512 ? native_dkernel_avx512 \
+                             : isa == NATIVE_AVX2 ? native_dkernel_avx2 : native_dkernel_generic)
+#define NATIVE_BF16KERNEL(isa) native_bf16kernel_avx512
+
+NATIVE_GEMM(native_s, float, float, float, COPY_LOAD, 1, NATIVE_SKERNEL)
+NATIVE_GEMM(native_d, double, double, double, COPY_LOAD, 1, NATIVE_DKERNEL)
+// Low precision inputs are widened to fp32 while they are packed, then run through the fp32 kernels
+NATIVE_GEMM(native_bf16_, float, gemm_bf16, float, BF16_LOAD, 1, NATIVE_SKERNEL)
+NATIVE_GEMM(native_fp16_, float, gemm_fp16, float, FP16_LOAD, 1, NATIVE_SKERNEL)
+// bf16 stays bf16 for vdpbf16ps, with 2 K values per fp32 lane
+NATIVE_GEMM(native_bf16dp_, float, gemm_bf16, gemm_bf16, COPY_LOAD, 2, NATIVE_BF16KERNEL)
+
+// The dot products are opt-in with GEMM_NATIVE_BF16=dot and need AVX-512 BF16. By default bf16 is
+// widened: on the AVX-512 BF16 cores measured the 48x8 fp32 kernel reached about 80 GFLOPS per core on
+// widened bf16, the vdpbf16ps kernel about 55.
+int native_has_bf16() {
+    const char *forced = getenv("GEMM_NATIVE_BF16");
+    __builtin_cpu_init();
+    return forced != NULL && strcmp(forced, "dot") == 0 && native_select_isa() == NATIVE_AVX512 &&
+           __builtin_cpu_supports("avx512bf16");
+}
+
+void native_sgemm(int order, int transa, int transb, int m, int n, int k, float alpha, const float *A, int lda, const float *B, int ldb, float beta, float *C, int ldc) {
+    if (order != GEMM_COL_MAJOR || transa != GEMM_NO_TRANS || transb != GEMM_NO_TRANS) {
+        fprintf(stderr, " Native gemm only supports column major, non transposed operands\n");
+        return;
+    }
+    native_sgemm_blocked(m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, &native_blocking);
+}
+
+void native_dgemm(int order, int transa, int transb, int m, int n, int k, double alpha, const double *A, int lda, const double *B, int ldb, double beta, double *C, int ldc) {
+    if (order != GEMM_COL_MAJOR || transa != GEMM_NO_TRANS || transb != GEMM_NO_TRANS) {
+        fprintf(stderr, " Native gemm only supports column major, non transposed operands\n");
+        return;
+    }
+    native_dgemm_blocked(m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, &native_blocking);
+}
+
+void native_gemm_bf16(int order, int transa, int transb, int m, int n, int k, float alpha, const void *A, int lda, const void *B, int ldb, float beta, float *C, int ldc) {
+    if (order != GEMM_COL_MAJOR || transa != GEMM_NO_TRANS || transb != GEMM_NO_TRANS) {
+        fprintf(stderr, " Native gemm only supports column major, non transposed operands\n");
+        return;
+    }
+    if (native_has_bf16()) {
+        native_bf16dp_gemm_blocked(m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, &native_blocking);
+    } else {
+        native_bf16_gemm_blocked(m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, &native_blocking);
+    }
+}
+
+void native_gemm_fp16(int order, int transa, int transb, int m, int n, int k, float alpha, const void *A, int lda, const void *B, int ldb, float beta, float *C, int ldc) {
+    if (order != GEMM_COL_MAJOR || transa != GEMM_NO_TRANS || transb != GEMM_NO_TRANS) {
+        fprintf(stderr, " Native gemm only supports column major, non transposed operands\n");
+        return;
+    }
+    native_fp16_gemm_blocked(m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, &native_blocking);
+}
@@ -0,0 +1,98 @@
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Memory placement of the matrices.
+// Buffers are aligned to 2 MB and advised for transparent huge pages, then placed with one of
+//   first-touch  every thread initialises the pages of its static OpenMP chunk, so with
+//                OMP_PROC_BIND=close|spread the matrices are spread over the NUMA nodes of the threads
+//   interleave   pages are interleaved round robin over all the nodes (mbind), then touched in parallel
+//   serial       the master thread touches everything, all the pages land on its node
+// The placement is written to the results, so that close and spread runs compare the libraries
+// and not where the pages happen to be.
+
+#define PLACEMENT_ALIGNMENT (2 << 20)
+#define PLACEMENT_MPOL_INTERLEAVE 3  // from linux/mempolicy.h, numactl headers are not required
+#define PLACEMENT_MAX_NODES 1024
+
+enum placement_policy { PLACE_FIRST_TOUCH, PLACE_INTERLEAVE, PLACE_SERIAL, NUM_PLACEMENTS };
+const char *placement_names[NUM_PLACEMENTS] = {"first-touch", "interleave", "serial"};
+
+int parse_placement(const char *name);
+void *placed_alloc(size_t bytes, int *policy, int *huge_pages);
+const char *proc_bind_name();
+void describe_placement(char *buffer, size_t size, int policy, const char *binding, int huge_pages);
+
+// Returns -1 on an unknown name
+int parse_placement(const char *name) {
+    for (int p = 0; p < NUM_PLACEMENTS; p++) {
+        if (strcmp(name, placement_names[p]) == 0) {
+            return p;
+        }
+    }
+    return -1;
+}
+
+// The requested bytes are zeroed with the policy, in static chunks of the byte range: an array of one
+// type that fills them is split the same way, up to a page, by a static OpenMP loop over its elements.
+// huge_pages is cleared if the kernel refused the advice, policy becomes first-touch if the pages
+// could not be interleaved, so that the results record the placement actually used.
+void *placed_alloc(size_t bytes, int *policy, int *huge_pages) {
+    size_t size = (bytes + PLACEMENT_ALIGNMENT - 1) / PLACEMENT_ALIGNMENT * PLACEMENT_ALIGNMENT;
+    void *buffer = aligned_alloc(PLACEMENT_ALIGNMENT, size > 0 ? size : PLACEMENT_ALIGNMENT);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(buffer, size, MADV_HUGEPAGE) != 0) {
+        *huge_pages = 0;
+    }
+#else
+    *huge_pages = 0;
+#endif
+
+    if (*policy == PLACE_INTERLEAVE) {
+        // All the bits set: the kernel restricts the mask to the nodes this process may use
+        unsigned long nodemask[PLACEMENT_MAX_NODES / (8 * sizeof(unsigned long))];
+        memset(nodemask, 0xff, sizeof(nodemask));
+        if (syscall(SYS_mbind, buffer, size, PLACEMENT_MPOL_INTERLEAVE, nodemask, PLACEMENT_MAX_NODES, 0) != 0) {
+            fprintf(stderr, " Unable to interleave the matrices, falling back to first touch\n");
+            *policy = PLACE_FIRST_TOUCH;
+        }
+    }
+
+    // Not the rounded size, the padding would shift the chunks of the threads
+    char *bytes_buffer = buffer;
+    size_t touched = (bytes + 4095) / 4096 * 4096;
+#pragma omp parallel for schedule(static) if(*policy != PLACE_SERIAL)
+    for (size_t i = 0; i < touched; i += 4096) {
+        memset(bytes_buffer + i, 0, 4096);
+    }
+    return buffer;
+}
+
+const char *proc_bind_name() {
+    switch (omp_get_proc_bind()) {
+        case omp_proc_bind_false:
+            return "false";
+        case omp_proc_bind_true:
+            return "true";
+        case omp_proc_bind_close:
+            return "close";
+        case omp_proc_bind_spread:
+            return "spread";
+        default:
+            return "master";
+    }
+}
+
+// e.g. first-touch/spread/thp, the string has no commas so it fits in a CSV column.
+// binding is proc_bind_name(), or the policy of the sweep (sweep.h)
+void describe_placement(char *buffer, size_t size, int policy, const char *binding, int huge_pages) {
+    snprintf(buffer, size, "%s/%s/%s", placement_names[policy], binding, huge_pages ? "thp" : "4k");
+}
@@ -0,0 +1,186 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Precisions selectable at runtime with -p.
+//   float, double   the CBLAS sgemm and dgemm
+//   bf16, fp16      16 bit A and B, fp32 accumulation and C (cblas_gemm_bf16bf16f32 and
+//                   cblas_gemm_f16f16f32 in MKL, cblas_sbgemm in OpenBLAS, native on every CPU)
+//   float-refined   double A, B and C computed with fp32 gemm only (Ozaki splitting): every row of A
+//                   and column of B is split into REFINE_SLICES slices of REFINE_BITS bits on a common
+//                   power of two grid, so that the products of two slices summed over REFINE_KC terms
+//                   are exact in fp32. The slice products are added up in double, with the terms below
+//                   2^-16 of the result grouped in one fp32 sum, for an error around 1e-13.
+// Every run is checked against REFERENCE_SAMPLES entries of C recomputed in double with a
+// compensated sum from the analytic entries of A and B, the largest relative error is reported.
+
+#define REFINE_SLICES 6
+#define REFINE_BITS 8
+#define REFINE_KC (1 << (24 - 2 * REFINE_BITS))
+#define REFERENCE_SAMPLES 64
+
+enum precision { PREC_FLOAT, PREC_DOUBLE, PREC_BF16, PREC_FP16, PREC_REFINED, NUM_PRECISIONS };
+const char *precision_names[NUM_PRECISIONS] = {"float", "double", "bf16", "fp16", "float-refined"};
+// Bytes of an element of A and B, and of an element of C
+const size_t precision_sizes[NUM_PRECISIONS] = {sizeof(float), sizeof(double), sizeof(gemm_bf16), sizeof(gemm_fp16), sizeof(double)};
+const size_t output_sizes[NUM_PRECISIONS] = {sizeof(float), sizeof(double), sizeof(float), sizeof(float), sizeof(double)};
+
+double a_entry(long index);
+double b_entry(long index);
+void store_entry(int precision, void *X, long index, double value);
+double load_entry(int precision, const void *X, long index);
+double load_output(int precision, const void *C, long index);
+void refine_split(const double *X, float *slices, long slice_size, int lines, int length, long line_stride, long element_stride);
+void refine_accumulate(double *C, const float *t, long count, int first);
+void refined_gemm(struct gemm_backend *backend, int m, int k, int n, const double *A, const double *B, double *C, float *workspace);
+size_t refine_workspace_size(int m, int k, int n);
+double max_relative_error(int precision, int m, int k, int n, const void *C);
+double block_relative_error(int precision, int m, int k, long row, long column, int rows, int columns, const void *C);
+
+// Entries in [-1, 1], representable in the range of every precision, and analytic so that the
+// reference never needs a double copy of the matrices. Index is the column major position.
+double a_entry(long index) {
+    return (double)(index % 1021 + 1) / 1021;
+}
+
+double b_entry(long index) {
+    return -(double)(index % 1019 + 1) / 1019;
+}
+
+void store_entry(int precision, void *X, long index, double value) {
+    switch (precision) {
+        case PREC_FLOAT:
+            ((float *)X)[index] = (float)value;
+            break;
+        case PREC_BF16:
+            ((gemm_bf16 *)X)[index] = float_to_bf16((float)value);
+            break;
+        case PREC_FP16:
+            ((gemm_fp16 *)X)[index] = (gemm_fp16)value;
+            break;
+        default:
+            ((double *)X)[index] = value;
+    }
+}
+
+double load_entry(int precision, const void *X, long index) {
+    switch (precision) {
+        case PREC_FLOAT:
+            return ((const float *)X)[index];
+        case PREC_BF16:
+            return bf16_to_float(((const gemm_bf16 *)X)[index]);
+        case PREC_FP16:
+            return (double)((const gemm_fp16 *)X)[index];
+        default:
+            return ((const double *)X)[index];
+    }
+}
+
+double load_output(int precision, const void *C, long index) {
+    return output_sizes[precision] == sizeof(float) ? ((const float *)C)[index] : ((const double *)C)[index];
+}
+
+size_t refine_workspace_size(int m, int k, int n) {
+    return (REFINE_SLICES * ((size_t)m * k + (size_t)k * n) + (size_t)m * n) * sizeof(float);
+}
+
+// Every line (row of A, column of B) is split on the grid of its largest entry: slice s holds the
+// multiples of 2^(e - REFINE_BITS (s + 1)), where 2^e bounds the line, what is left goes to the next slice
+void refine_split(const double *X, float *slices, long slice_size, int lines, int length, long line_stride, long element_stride) {
+#pragma omp parallel for schedule(static)
+    for (int l = 0; l < lines; l++) {
+        const double *x = X + l * line_stride;
+        double largest = 0.0;
+        int exponent;
+        for (int p = 0; p < length; p++) {
+            largest = fmax(largest, fabs(x[p * element_stride]));
+        }
+        frexp(largest, &exponent);
+        for (int p = 0; p < length; p++) {
+            double rest = x[p * element_stride];
+            for (int s = 0; s < REFINE_SLICES; s++) {
+                double unit = ldexp(1.0, exponent - REFINE_BITS * (s + 1));
+                double slice = rint(rest / unit) * unit;
+                slices[s * slice_size + l * line_stride + p * element_stride] = (float)slice;
+                rest -= slice;
+            }
+        }
+    }
+}
+
+void refine_accumulate(double *C, const float *t, long count, int first) {
+#pragma omp parallel for schedule(static)
+    for (long i = 0; i < count; i++) {
+        C[i] = first ? t[i] : C[i] + t[i];
+    }
+}
+
+void refined_gemm(struct gemm_backend *backend, int m, int k, int n, const double *A, const double *B, double *C, float *workspace) {
+    long a_size = (long)m * k, b_size = (long)k * n;
+    float *a = workspace, *b = a + REFINE_SLICES * a_size;
+    float *t = b + REFINE_SLICES * b_size;
+
+    refine_split(A, a, a_size, m, k, 1, m);
+    refine_split(B, b, b_size, n, k, k, 1);
+
+#define SLICE_GEMM(S, T, BETA) backend->sgemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, kc, 1.0f,   \
+                                              a + (S) * a_size + (long)pc * m, m, b + (T) * b_size + pc, k, \
+                                              BETA, t, m)
+    for (int pc = 0; pc < k; pc += REFINE_KC) {
+        int kc = k - pc < REFINE_KC ? k - pc : REFINE_KC;
+        // The leading products are exact, each one is added to C on its own
+        SLICE_GEMM(0, 0, 0.0f);
+        refine_accumulate(C, t, (long)m * n, pc == 0);
+        SLICE_GEMM(0, 1, 0.0f);
+        refine_accumulate(C, t, (long)m * n, 0);
+        SLICE_GEMM(1, 0, 0.0f);
+        refine_accumulate(C, t, (long)m * n, 0);
+        // The others are below 2^-16 of C, the rounding of their fp32 sum is below 2^-40
+        for (int d = 2; d < REFINE_SLICES; d++) {
+            for (int s = 0; s <= d; s++) {
+                SLICE_GEMM(s, d - s, d == 2 && s == 0 ? 0.0f : 1.0f);
+            }
+        }
+        refine_accumulate(C, t, (long)m * n, 0);
+    }
+#undef SLICE_GEMM
+}
+
+// The sampled positions are the same for every run, so the errors of the backends are comparable.
+// The reference uses the exact entries, the rounding of A and B to the precision counts as error.
+double max_relative_error(int precision, int m, int k, int n, const void *C) {
+    return block_relative_error(precision, m, k, 0, 0, m, n, C);
+}
+
+// Same check on the rows x columns block of an m x k by k x n product that starts at (row, column),
+// stored column major with leading dimension rows
+double block_relative_error(int precision, int m, int k, long row, long column, int rows, int columns, const void *C) {
+    unsigned long state = 12345;
+    double max_error = 0.0;
+
+    for (int s = 0; s < REFERENCE_SAMPLES && rows > 0 && columns > 0; s++) {
+        state = state * 6364136223846793005UL + 1442695040888963407UL;
+        long i = s == 0 ? 0 : (long)((state >> 33) % rows);
+        long j = s == 0 ? 0 : (long)((state >> 13) % columns);
+
+        // Neumaier summation
+        double sum = 0.0, compensation = 0.0;
+        for (int p = 0; p < k; p++) {
+            double term = a_entry(row + i + (long)p * m) * b_entry(p + (column + j) * k);
+            double t = sum + term;
+            compensation += fabs(sum) >= fabs(term) ? (sum - t) + term : (term - t) + sum;
+            sum = t;
+        }
+        double reference = sum + compensation;
+        double error = fabs(load_output(precision, C, i + j * rows) - reference) / fabs(reference);
+        if (isnan(error)) {
+            return error;
+        }
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+    return max_error;
+}
@@ -0,0 +1,299 @@
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Distributed GEMM with SUMMA on a 2D grid of MPI ranks (built only in gemm_mpi.x, -DWITH_MPI).
+// Rank (r, c) of the P x Q grid owns the blocks
+//   A  rows r of m in P parts, columns c of k in Q parts
+//   B  rows r of k in P parts, columns c of n in Q parts
+//   C  rows r of m in P parts, columns c of n in Q parts
+// and C is built panel by panel along k: the owner column of the next columns of A broadcasts them
+// along its grid row, the owner row of the next rows of B along its grid column, and every rank adds
+// the product of the two panels to its C block with the local backend. Panels are at most
+// GEMM_SUMMA_PANEL wide (SUMMA_DEFAULT_PANEL) and never cross a block boundary of A or B.
+// The broadcasts are non blocking and double buffered: panel t + 1 is on its way during the
+// local gemm of panel t.
+// Nothing is ever stored whole, the blocks are initialised from the analytic entries and the
+// product is checked with the sampled reference and a Freivalds check split over the grid.
+
+#define SUMMA_DEFAULT_PANEL 256
+
+struct summa_grid {
+    MPI_Comm comm, row, column, node;
+    int rank, size;
+    int rows, columns;      // P x Q
+    int my_row, my_column;
+    int nodes;              // shared memory nodes spanned by the grid
+};
+
+// Arguments of one timed product, see bench_run
+struct summa_call {
+    struct gemm_backend *backend;
+    int precision;
+    struct summa_grid *grid;
+    int m, k, n, panel;
+    int local_m, local_n;       // rows and columns of the C block
+    int local_ka, local_kb;     // columns of the A block, rows of the B block
+    long m0, n0, ka0, kb0;      // first global row and column of the blocks
+    void *A, *B, *C;
+    void *a_panels[2], *b_panels[2];
+};
+
+long block_start(long size, int parts, int index);
+int block_owner(long size, int parts, long position);
+void summa_grid_create(struct summa_grid *grid, int m, int k, int n);
+void summa_grid_free(struct summa_grid *grid);
+int summa_setup(struct summa_call *call, struct summa_grid *grid, int precision, int m, int k, int n, int *placement, int *huge_pages);
+void summa_free(struct summa_call *call);
+void summa_initialize(struct summa_call *call, int parallel);
+void summa_local_gemm(struct gemm_backend *backend, int precision, int m, int n, int k, const void *A, int lda, const void *B, int ldb, void *C, int ldc, float beta);
+long summa_panel_end(const struct summa_call *call, long p0);
+void summa_post(struct summa_call *call, long p0, int width, int buffer, const void **a_panel, MPI_Request *requests);
+void summa_multiply(struct summa_call *call);
+void run_summa_call(void *argument);
+void summa_verify(const struct summa_call *call, double *error, struct verify_result *result);
+
+// The blocks of a partition differ by at most one
+long block_start(long size, int parts, int index) {
+    return size * index / parts;
+}
+
+int block_owner(long size, int parts, long position) {
+    int owner = 0;
+    while (owner + 1 < parts && block_start(size, parts, owner + 1) <= position) {
+        owner++;
+    }
+    return owner;
+}
+
+// The grid is as square as MPI_Dims_create makes it, the rows of the grid split m
+void summa_grid_create(struct summa_grid *grid, int m, int k, int n) {
+    int dims[2] = {0, 0}, periods[2] = {0, 0}, coords[2];
+    int keep_rows[2] = {0, 1}, keep_columns[2] = {1, 0};
+    int node_rank, leader;
+
+    MPI_Comm_size(MPI_COMM_WORLD, &grid->size);
+    MPI_Dims_create(grid->size, 2, dims);
+    grid->rows = dims[0];
+    grid->columns = dims[1];
+    if (m < grid->rows || n < grid->columns || k < grid->rows || k < grid->columns) {
+        fprintf(stderr, " ERROR: %dx%dx%d is too small for a %dx%d grid of ranks\n", m, k, n, grid->rows, grid->columns);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, &grid->comm);
+    MPI_Comm_rank(grid->comm, &grid->rank);
+    MPI_Cart_coords(grid->comm, grid->rank, 2, coords);
+    grid->my_row = coords[0];
+    grid->my_column = coords[1];
+    MPI_Cart_sub(grid->comm, keep_rows, &grid->row);
+    MPI_Cart_sub(grid->comm, keep_columns, &grid->column);
+
+    MPI_Comm_split_type(grid->comm, MPI_COMM_TYPE_SHARED, grid->rank, MPI_INFO_NULL, &grid->node);
+    MPI_Comm_rank(grid->node, &node_rank);
+    leader = node_rank == 0;
+    MPI_Allreduce(&leader, &grid->nodes, 1, MPI_INT, MPI_SUM, grid->comm);
+}
+
+void summa_grid_free(struct summa_grid *grid) {
+    MPI_Comm_free(&grid->node);
+    MPI_Comm_free(&grid->column);
+    MPI_Comm_free(&grid->row);
+    MPI_Comm_free(&grid->comm);
+}
+
+// Returns 0 if the blocks could not be allocated
+int summa_setup(struct summa_call *call, struct summa_grid *grid, int precision, int m, int k, int n, int *placement, int *huge_pages) {
+    const char *panel = getenv("GEMM_SUMMA_PANEL");
+    size_t size = precision_sizes[precision];
+
+    memset(call, 0, sizeof(*call));
+    call->precision = precision;
+    call->grid = grid;
+    call->m = m;
+    call->k = k;
+    call->n = n;
+    call->panel = panel != NULL && atoi(panel) > 0 ? atoi(panel) : SUMMA_DEFAULT_PANEL;
+    call->m0 = block_start(m, grid->rows, grid->my_row);
+    call->local_m = block_start(m, grid->rows, grid->my_row + 1) - call->m0;
+    call->n0 = block_start(n, grid->columns, grid->my_column);
+    call->local_n = block_start(n, grid->columns, grid->my_column + 1) - call->n0;
+    call->ka0 = block_start(k, grid->columns, grid->my_column);
+    call->local_ka = block_start(k, grid->columns, grid->my_column + 1) - call->ka0;
+    call->kb0 = block_start(k, grid->rows, grid->my_row);
+    call->local_kb = block_start(k, grid->rows, grid->my_row + 1) - call->kb0;
+    if (call->panel > k) {
+        call->panel = k;
+    }
+
+    call->A = placed_alloc((size_t)call->local_m * call->local_ka * size, placement, huge_pages);
+    call->B = placed_alloc((size_t)call->local_kb * call->local_n * size, placement, huge_pages);
+    call->C = placed_alloc((size_t)call->local_m * call->local_n * output_sizes[precision], placement, huge_pages);
+    for (int b = 0; b < 2; b++) {
+        call->a_panels[b] = placed_alloc((size_t)call->local_m * call->panel * size, placement, huge_pages);
+        call->b_panels[b] = placed_alloc((size_t)call->panel * call->local_n * size, placement, huge_pages);
+    }
+    return call->A != NULL && call->B != NULL && call->C != NULL && call->a_panels[0] != NULL &&
+           call->a_panels[1] != NULL && call->b_panels[0] != NULL && call->b_panels[1] != NULL;
+}
+
+void summa_free(struct summa_call *call) {
+    free(call->A);
+    free(call->B);
+    free(call->C);
+    for (int b = 0; b < 2; b++) {
+        free(call->a_panels[b]);
+        free(call->b_panels[b]);
+    }
+}
+
+// The entries are the ones of the undistributed matrices, at their global column major positions
+void summa_initialize(struct summa_call *call, int parallel) {
+    int precision = call->precision;
+    long m = call->m, k = call->k;
+#pragma omp parallel if(parallel)
+    {
+#pragma omp for schedule(static)
+        for (long i = 0; i < (long)call->local_m * call->local_ka; i++) {
+            long row = call->m0 + i % call->local_m, column = call->ka0 + i / call->local_m;
+            store_entry(precision, call->A, i, a_entry(row + column * m));
+        }
+#pragma omp for schedule(static)
+        for (long i = 0; i < (long)call->local_kb * call->local_n; i++) {
+            long row = call->kb0 + i % call->local_kb, column = call->n0 + i / call->local_kb;
+            store_entry(precision, call->B, i, b_entry(row + column * k));
+        }
+#pragma omp for schedule(static)
+        for (long i = 0; i < (long)call->local_m * call->local_n; i++) {
+            if (output_sizes[precision] == sizeof(float)) ((float *)call->C)[i] = 0.0;
+            else ((double *)call->C)[i] = 0.0;
+        }
+    }
+}
+
+void summa_local_gemm(struct gemm_backend *backend, int precision, int m, int n, int k, const void *A, int lda, const void *B, int ldb, void *C, int ldc, float beta) {
+    switch (precision) {
+        case PREC_FLOAT:
+            backend->sgemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k, 1.0f, A, lda, B, ldb, beta, C, ldc);
+            break;
+        case PREC_DOUBLE:
+            backend->dgemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k, 1.0, A, lda, B, ldb, beta, C, ldc);
+            break;
+        case PREC_BF16:
+            backend->bf16gemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k, 1.0f, A, lda, B, ldb, beta, C, ldc);
+            break;
+        case PREC_FP16:
+            backend->fp16gemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k, 1.0f, A, lda, B, ldb, beta, C, ldc);
+            break;
+    }
+}
+
+// The panel starting at p0 ends at the first block boundary of A or B, or after call->panel columns
+long summa_panel_end(const struct summa_call *call, long p0) {
+    struct summa_grid *grid = call->grid;
+    long end = p0 + call->panel;
+    long a_end = block_start(call->k, grid->columns, block_owner(call->k, grid->columns, p0) + 1);
+    long b_end = block_start(call->k, grid->rows, block_owner(call->k, grid->rows, p0) + 1);
+    if (a_end < end) {
+        end = a_end;
+    }
+    if (b_end < end) {
+        end = b_end;
+    }
+    return end;
+}
+
+// The owner of the A columns broadcasts straight from its block, which is contiguous in column
+// major order; the rows of B are packed by their owner into the panel buffer first
+void summa_post(struct summa_call *call, long p0, int width, int buffer, const void **a_panel, MPI_Request *requests) {
+    struct summa_grid *grid = call->grid;
+    size_t size = precision_sizes[call->precision];
+    int a_owner = block_owner(call->k, grid->columns, p0);
+    int b_owner = block_owner(call->k, grid->rows, p0);
+    char *b_panel = call->b_panels[buffer];
+
+    if (grid->my_column == a_owner) {
+        *a_panel = (char *)call->A + (p0 - call->ka0) * call->local_m * size;
+    } else {
+        *a_panel = call->a_panels[buffer];
+    }
+    MPI_Ibcast((void *)*a_panel, (int)((size_t)call->local_m * width * size), MPI_BYTE, a_owner, grid->row, &requests[0]);
+
+    if (grid->my_row == b_owner) {
+        const char *source = (const char *)call->B + (p0 - call->kb0) * size;
+        for (int j = 0; j < call->local_n; j++) {
+            memcpy(b_panel + (size_t)j * width * size, source + (size_t)j * call->local_kb * size, width * size);
+        }
+    }
+    MPI_Ibcast(b_panel, (int)((size_t)width * call->local_n * size), MPI_BYTE, b_owner, grid->column, &requests[1]);
+}
+
+void summa_multiply(struct summa_call *call) {
+    MPI_Request requests[2][2];
+    const void *a_panels[2];
+    long p0 = 0, end = summa_panel_end(call, 0);
+    int buffer = 0;
+
+    summa_post(call, p0, end - p0, buffer, &a_panels[buffer], requests[buffer]);
+    while (p0 < call->k) {
+        int width = end - p0;
+        long next = end, next_end = next < call->k ? summa_panel_end(call, next) : next;
+
+        MPI_Waitall(2, requests[buffer], MPI_STATUSES_IGNORE);
+        // The other buffers were last read by the previous local gemm, they can be refilled
+        if (next < call->k) {
+            summa_post(call, next, next_end - next, 1 - buffer, &a_panels[1 - buffer], requests[1 - buffer]);
+        }
+        summa_local_gemm(call->backend, call->precision, call->local_m, call->local_n, width,
+                         a_panels[buffer], call->local_m, call->b_panels[buffer], width,
+                         call->C, call->local_m, p0 == 0 ? 0.0f : 1.0f);
+        p0 = next;
+        end = next_end;
+        buffer = 1 - buffer;
+    }
+}
+
+// Every rank times the same interval, from the barrier before to the barrier after the product
+void run_summa_call(void *argument) {
+    struct summa_call *call = argument;
+    MPI_Barrier(call->grid->comm);
+    summa_multiply(call);
+    MPI_Barrier(call->grid->comm);
+}
+
+// error is the largest sampled relative error over all the blocks. The Freivalds products are
+// split like the matrices: B x is summed over the whole grid, A (B x) and C x along the grid rows.
+// NaN becomes infinity before the reductions, whose MAX is undefined for NaN.
+void summa_verify(const struct summa_call *call, double *error, struct verify_result *result) {
+    struct summa_grid *grid = call->grid;
+    int precision = call->precision, k = call->k, n = call->n, m = call->local_m;
+    double *x = malloc((2 * (size_t)n + 2 * (size_t)k + 4 * (size_t)m) * sizeof(double));
+    double *x_abs = x + n, *z = x_abs + n, *z_abs = z + k;
+    double *w = z_abs + k, *w_abs = w + m, *y = w_abs + m, *y_abs = y + m;
+
+    if (x == NULL) {
+        fprintf(stderr, " Unable to allocate the verification vectors\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    *error = block_relative_error(precision, call->m, k, call->m0, call->n0, call->local_m, call->local_n, call->C);
+    *error = isnan(*error) ? INFINITY : *error;
+    MPI_Allreduce(MPI_IN_PLACE, error, 1, MPI_DOUBLE, MPI_MAX, grid->comm);
+
+    verify_vector(n, x, x_abs);
+    memset(z, 0, 2 * (size_t)k * sizeof(double));
+    verify_gemv(precision, 0, call->local_kb, call->local_n, call->B, x + call->n0, x_abs + call->n0, z + call->kb0, z_abs + call->kb0);
+    MPI_Allreduce(MPI_IN_PLACE, z, 2 * k, MPI_DOUBLE, MPI_SUM, grid->comm);
+    verify_gemv(precision, 0, m, call->local_ka, call->A, z + call->ka0, z_abs + call->ka0, w, w_abs);
+    verify_gemv(precision, 1, m, call->local_n, call->C, x + call->n0, x_abs + call->n0, y, y_abs);
+    // w, w_abs, y and y_abs are contiguous
+    MPI_Allreduce(MPI_IN_PLACE, w, 4 * m, MPI_DOUBLE, MPI_SUM, grid->row);
+
+    result->tolerance = verify_tolerance(precision, k, n);
+    result->residual = verify_residual(m, y, w, w_abs);
+    result->residual = isnan(result->residual) ? INFINITY : result->residual;
+    MPI_Allreduce(MPI_IN_PLACE, &result->residual, 1, MPI_DOUBLE, MPI_MAX, grid->comm);
+    result->passed = result->residual <= result->tolerance;
+    free(x);
+}
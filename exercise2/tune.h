@@ -0,0 +1,308 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Autotuning of the block sizes and of the thread grid.
+// The native backend is tuned on MC, KC, NC and tm x tn, BLIS on its ic x jr thread ways
+// (through bli_thread_set_ways, when the library exports it); the other libraries tune themselves.
+// The search is a coordinate descent from the defaults: thread grid, then KC, MC and NC, each
+// candidate timed as the best of TUNE_REPEATS calls. Large shapes are tuned on a problem of at most
+// TUNE_MAX_DIM per dimension: the start of each buffer is read as a dense matrix with leading dimension
+// tm (A, C) or tk (B), not as a corner of the full matrices. The values do not matter for the timing,
+// and a dense problem of that size has the cache behaviour of the blocking it tunes.
+//
+// The best configurations are kept in a per-host cache file, one line per
+//   backend precision threads m k n mc kc nc tm tn gflops
+// The file is $GEMM_TUNE_FILE if set, otherwise gemm_tune_<hostname>.cfg in the working directory.
+// Later runs pick the entry with the same backend, precision and thread count and the closest shape.
+// The file keeps the TUNE_MAX_ENTRIES most recent entries, older ones are dropped with a warning.
+// It is rewritten into a temporary file renamed over the old one, so concurrent runs never read half a file.
+
+#define TUNE_MAX_DIM 2048
+#define TUNE_REPEATS 3
+#define TUNE_MAX_ENTRIES 256
+
+typedef void (*set_ways_fn)(long jc, long pc, long ic, long jr, long ir);
+typedef void (*set_num_threads_fn)(long threads);
+
+struct tune_entry {
+    char backend[16];
+    char precision[16];
+    int threads;
+    int m, k, n;
+    struct gemm_blocking blocking;
+    double gflops;
+};
+
+void tune_filename(char *buffer, size_t size);
+int tune_load(struct tune_entry *entries, int max_entries);
+void tune_save(const struct tune_entry *entry);
+const struct tune_entry *tune_lookup(const struct tune_entry *entries, int count, const char *backend, const char *precision, int m, int k, int n);
+int tune_supported(struct gemm_backend *backend);
+void tune_apply(struct gemm_backend *backend, const struct gemm_blocking *blocking);
+void tune_reset(struct gemm_backend *backend);
+double tune_time(struct gemm_backend *backend, size_t type_size, int m, int k, int n, void *A, void *B, void *C, const struct gemm_blocking *blocking);
+void autotune(struct gemm_backend *backend, const char *precision, size_t type_size, int m, int k, int n, void *A, void *B, void *C, struct tune_entry *result);
+
+void tune_filename(char *buffer, size_t size) {
+    char hostname[128] = "unknown";
+    const char *forced = getenv("GEMM_TUNE_FILE");
+    if (forced != NULL) {
+        snprintf(buffer, size, "%s", forced);
+        return;
+    }
+    gethostname(hostname, sizeof(hostname) - 1);
+    hostname[sizeof(hostname) - 1] = '\0';
+    // Keep only the short name, the nodes of a partition share the domain
+    char *dot = strchr(hostname, '.');
+    if (dot != NULL) {
+        *dot = '\0';
+    }
+    snprintf(buffer, size, "gemm_tune_%s.cfg", hostname);
+}
+
+// Returns the number of entries read, a missing file is an empty cache.
+// Entries are appended by tune_save, so past max_entries the oldest are the ones left out
+int tune_load(struct tune_entry *entries, int max_entries) {
+    char filename[256], line[256];
+    struct tune_entry e;
+    int count = 0, dropped = 0;
+
+    tune_filename(filename, sizeof(filename));
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%15s %15s %d %d %d %d %d %d %d %d %d %lf", e.backend, e.precision, &e.threads,
+                   &e.m, &e.k, &e.n, &e.blocking.mc, &e.blocking.kc, &e.blocking.nc,
+                   &e.blocking.tm, &e.blocking.tn, &e.gflops) != 12) {
+            continue;
+        }
+        if (count == max_entries) {
+            memmove(entries, entries + 1, (size_t)(max_entries - 1) * sizeof(*entries));
+            count--;
+            dropped++;
+        }
+        entries[count++] = e;
+    }
+    fclose(file);
+    if (dropped > 0) {
+        fprintf(stderr, " The tuning cache %s holds more than %d entries, ignoring the %d oldest\n", filename, max_entries, dropped);
+    }
+    return count;
+}
+
+// Add the entry to the cache, replacing the one with the same key and evicting the oldest one
+// when the cache is full
+void tune_save(const struct tune_entry *entry) {
+    static struct tune_entry entries[TUNE_MAX_ENTRIES];
+    char filename[256], temporary[300];
+    int count = tune_load(entries, TUNE_MAX_ENTRIES), kept = 0, first = 0;
+
+    // Drop the entry being replaced, then make room for the new one
+    for (int i = 0; i < count; i++) {
+        const struct tune_entry *e = &entries[i];
+        if (strcmp(e->backend, entry->backend) != 0 || strcmp(e->precision, entry->precision) != 0 ||
+            e->threads != entry->threads || e->m != entry->m || e->k != entry->k || e->n != entry->n) {
+            entries[kept++] = *e;
+        }
+    }
+    if (kept == TUNE_MAX_ENTRIES) {
+        first = 1;
+        fprintf(stderr, " The tuning cache is full (%d entries), dropping the oldest: %s %s %dx%dx%d\n", TUNE_MAX_ENTRIES,
+                entries[0].backend, entries[0].precision, entries[0].m, entries[0].k, entries[0].n);
+    }
+
+    tune_filename(filename, sizeof(filename));
+    snprintf(temporary, sizeof(temporary), "%s.%ld.tmp", filename, (long)getpid());
+    FILE *file = fopen(temporary, "w");
+    if (file == NULL) {
+        fprintf(stderr, " Unable to write the tuning cache %s\n", temporary);
+        return;
+    }
+    fprintf(file, "# backend precision threads m k n mc kc nc tm tn gflops\n");
+    for (int i = first; i < kept; i++) {
+        const struct tune_entry *e = &entries[i];
+        fprintf(file, "%s %s %d %d %d %d %d %d %d %d %d %.2f\n", e->backend, e->precision, e->threads,
+                e->m, e->k, e->n, e->blocking.mc, e->blocking.kc, e->blocking.nc, e->blocking.tm, e->blocking.tn, e->gflops);
+    }
+    fprintf(file, "%s %s %d %d %d %d %d %d %d %d %d %.2f\n", entry->backend, entry->precision, entry->threads,
+            entry->m, entry->k, entry->n, entry->blocking.mc, entry->blocking.kc, entry->blocking.nc,
+            entry->blocking.tm, entry->blocking.tn, entry->gflops);
+    int failed = ferror(file);
+    failed |= fclose(file) != 0;
+    if (failed || rename(temporary, filename) != 0) {
+        fprintf(stderr, " Unable to write the tuning cache %s\n", filename);
+        remove(temporary);
+    }
+}
+
+// The closest shape is the one with the smallest distance between the logarithms of the dimensions,
+// tuning at 4000 is a better guess for 5000 than the defaults
+const struct tune_entry *tune_lookup(const struct tune_entry *entries, int count, const char *backend, const char *precision, int m, int k, int n) {
+    const struct tune_entry *best = NULL;
+    double best_distance = 0.0;
+    int threads = omp_get_max_threads();
+
+    for (int i = 0; i < count; i++) {
+        const struct tune_entry *e = &entries[i];
+        if (strcmp(e->backend, backend) != 0 || strcmp(e->precision, precision) != 0 || e->threads != threads) {
+            continue;
+        }
+        double distance = fabs(log((double)e->m / m)) + fabs(log((double)e->k / k)) + fabs(log((double)e->n / n));
+        if (best == NULL || distance < best_distance) {
+            best = e;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+int tune_supported(struct gemm_backend *backend) {
+    if (strcmp(backend->name, "native") == 0) {
+        return 1;
+    }
+    return backend->handle != NULL && dlsym(backend->handle, "bli_thread_set_ways") != NULL;
+}
+
+// BLIS has no portable way to change its block sizes at runtime, only its thread ways:
+// tm becomes the ic (M) loop ways and tn the jr (N) loop ways, a 0x0 grid leaves BLIS its own threading
+void tune_apply(struct gemm_backend *backend, const struct gemm_blocking *blocking) {
+    if (strcmp(backend->name, "native") == 0) {
+        native_blocking = *blocking;
+        return;
+    }
+    set_ways_fn set_ways = backend->handle != NULL ? (set_ways_fn)dlsym(backend->handle, "bli_thread_set_ways") : NULL;
+    if (set_ways != NULL && blocking->tm > 0 && blocking->tn > 0) {
+        set_ways(1, 1, blocking->tm, blocking->tn, 1);
+    } else {
+        tune_reset(backend);
+    }
+}
+
+// Back to the defaults, for runs without a cache entry
+void tune_reset(struct gemm_backend *backend) {
+    if (strcmp(backend->name, "native") == 0) {
+        memset(&native_blocking, 0, sizeof(native_blocking));
+        return;
+    }
+    set_num_threads_fn set_num_threads = backend->handle != NULL ? (set_num_threads_fn)dlsym(backend->handle, "bli_thread_set_num_threads") : NULL;
+    if (set_num_threads != NULL) {
+        set_num_threads(omp_get_max_threads());
+    }
+}
+
+// Best of TUNE_REPEATS calls after a warm-up call, in GFLOPS
+double tune_time(struct gemm_backend *backend, size_t type_size, int m, int k, int n, void *A, void *B, void *C, const struct gemm_blocking *blocking) {
+    struct timespec begin, end;
+    double best = 0.0;
+
+    tune_apply(backend, blocking);
+    for (int r = 0; r <= TUNE_REPEATS; r++) {
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        if (type_size == sizeof(float)) {
+            backend->sgemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k, 1.0f, A, m, B, k, 0.0f, C, m);
+        } else {
+            backend->dgemm(GEMM_COL_MAJOR, GEMM_NO_TRANS, GEMM_NO_TRANS, m, n, k, 1.0, A, m, B, k, 0.0, C, m);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double elapsed = (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) * 1.0e-9;
+        double gflops = 2.0 * m * n * k / elapsed * 1.0e-9;
+        if (r > 0 && gflops > best) {
+            best = gflops;
+        }
+    }
+    return best;
+}
+
+// Try one value of a field, keep it if it is faster
+#define TUNE_TRY(FIELD, VALUE)                                                                  \
+    do {                                                                                        \
+        struct gemm_blocking candidate = best;                                                  \
+        candidate.FIELD = (VALUE);                                                              \
+        double gflops = tune_time(backend, type_size, tm, tk, tn, A, B, C, &candidate);         \
+        printf("   mc %5d kc %5d nc %5d grid %3dx%-3d %10.2f GFLOPS\n", candidate.mc, candidate.kc, \
+               candidate.nc, candidate.tm, candidate.tn, gflops);                               \
+        if (gflops > best_gflops) {                                                             \
+            best = candidate;                                                                   \
+            best_gflops = gflops;                                                               \
+        }                                                                                       \
+    } while (0)
+
+void autotune(struct gemm_backend *backend, const char *precision, size_t type_size, int m, int k, int n, void *A, void *B, void *C, struct tune_entry *result) {
+    int threads = omp_get_max_threads();
+    int native = strcmp(backend->name, "native") == 0;
+    int tm = m < TUNE_MAX_DIM ? m : TUNE_MAX_DIM;
+    int tk = k < TUNE_MAX_DIM ? k : TUNE_MAX_DIM;
+    int tn = n < TUNE_MAX_DIM ? n : TUNE_MAX_DIM;
+    struct gemm_blocking best = {0};
+    double best_gflops;
+    int mr = 1, nr = 1;
+
+    printf(" Tuning %s %s on %dx%dx%d with %d threads\n", backend->name, precision, tm, tk, tn, threads);
+    if (native) {
+        int isa = native_select_isa();
+        native_register_block(isa, type_size, &mr, &nr);
+        native_default_blocking(isa, type_size, tm, tn, &best);
+    }
+    // BLIS starts from its own threading (a 0x0 grid), every tm x tn grid is a candidate below
+    best_gflops = tune_time(backend, type_size, tm, tk, tn, A, B, C, &best);
+    printf("   mc %5d kc %5d nc %5d grid %3dx%-3d %10.2f GFLOPS (defaults)\n", best.mc, best.kc, best.nc, best.tm, best.tn, best_gflops);
+
+    // Thread grid: every factorisation of the thread count
+    for (int t = 1; t <= threads; t++) {
+        if (threads % t == 0 && t != best.tm) {
+            struct gemm_blocking grid = best;
+            grid.tm = t;
+            grid.tn = threads / t;
+            double gflops = tune_time(backend, type_size, tm, tk, tn, A, B, C, &grid);
+            printf("   grid %3dx%-3d %10.2f GFLOPS\n", grid.tm, grid.tn, gflops);
+            if (gflops > best_gflops) {
+                best = grid;
+                best_gflops = gflops;
+            }
+        }
+    }
+
+    if (native) {
+        const int kcs[] = {128, 192, 256, 320, 384, 512, 768};
+        const int mc_blocks[] = {2, 3, 4, 6, 8, 12, 16, 24};
+        const int ncs[] = {1024, 2048, 4080, 8160};
+        int kc0 = best.kc, mc0 = best.mc, nc0 = best.nc;
+
+        for (size_t i = 0; i < sizeof(kcs) / sizeof(kcs[0]); i++) {
+            if (kcs[i] != kc0 && kcs[i] < 2 * tk) TUNE_TRY(kc, kcs[i]);
+        }
+        for (size_t i = 0; i < sizeof(mc_blocks) / sizeof(mc_blocks[0]); i++) {
+            int mc = mc_blocks[i] * mr;
+            if (mc != mc0 && mc < 2 * tm) TUNE_TRY(mc, mc);
+        }
+        for (size_t i = 0; i < sizeof(ncs) / sizeof(ncs[0]); i++) {
+            int nc = (ncs[i] + nr - 1) / nr * nr;
+            if (nc != nc0 && nc < 2 * tn) TUNE_TRY(nc, nc);
+        }
+    }
+
+    printf(" Best %s %s: mc %d kc %d nc %d grid %dx%d%s, %.2f GFLOPS\n\n", backend->name, precision,
+           best.mc, best.kc, best.nc, best.tm, best.tn, best.tm == 0 ? " (BLIS defaults)" : "", best_gflops);
+
+    memset(result, 0, sizeof(*result));
+    snprintf(result->backend, sizeof(result->backend), "%s", backend->name);
+    snprintf(result->precision, sizeof(result->precision), "%s", precision);
+    result->threads = threads;
+    result->m = m;
+    result->k = k;
+    result->n = n;
+    result->blocking = best;
+    result->gflops = best_gflops;
+}
+
+#undef TUNE_TRY
@@ -0,0 +1,113 @@
+#include <math.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Freivalds check of every product: for a random vector x, C x is compared with A (B x), computed in
+// double from the stored A, B and C in O(mk + kn + mn) operations instead of O(mnk).
+// A correct gemm has |C x - A B x| <= (k + 2) u |A| |B| |x| row by row, with u the unit roundoff of
+// its accumulation; the double matrix-vector products add (k + n) 2^-53 of the same bound.
+// The residual is the largest ratio between the two sides, the check fails when it is above
+// VERIFY_SAFETY times the bound or not a number. Wrong indexing, races or a skipped call give
+// residuals far above it; a single wrong entry of a large fp32 product can hide below the bound.
+
+#define VERIFY_SAFETY 4.0
+
+struct verify_result {
+    double residual;   // max_i |C x - A B x|_i / (|A| |B| |x|)_i
+    double tolerance;  // largest residual accepted for this precision and shape
+    int passed;
+};
+
+double accumulation_unit(int precision);
+void verify_gemv(int precision, int output, int rows, int cols, const void *X, const double *x, const double *x_abs, double *y, double *y_abs);
+void verify_vector(int n, double *x, double *x_abs);
+double verify_tolerance(int precision, int k, int n);
+double verify_residual(int rows, const double *y, const double *w, const double *w_abs);
+void freivalds_check(int precision, int m, int k, int n, const void *A, const void *B, const void *C, struct verify_result *result);
+
+// Unit roundoff of the sums inside the gemm: bf16 and fp16 products are exact in fp32 and
+// accumulated there, float-refined is limited by its grouped fp32 sums of the small slice products
+double accumulation_unit(int precision) {
+    switch (precision) {
+        case PREC_DOUBLE:
+            return ldexp(1.0, -53);
+        case PREC_REFINED:
+            return ldexp(1.0, -40);
+        default:
+            return ldexp(1.0, -24);
+    }
+}
+
+// y = X x and y_abs = |X| x_abs, for a column major rows x cols matrix stored in the precision
+// (as an output of the precision if output is set)
+void verify_gemv(int precision, int output, int rows, int cols, const void *X, const double *x, const double *x_abs, double *y, double *y_abs) {
+    if (rows <= 0) {
+        return;  // an empty array section is not a valid reduction
+    }
+    memset(y, 0, rows * sizeof(double));
+    memset(y_abs, 0, rows * sizeof(double));
+#pragma omp parallel for schedule(static) reduction(+:y[:rows], y_abs[:rows])
+    for (int j = 0; j < cols; j++) {
+        for (int i = 0; i < rows; i++) {
+            long index = i + (long)j * rows;
+            double value = output ? load_output(precision, X, index) : load_entry(precision, X, index);
+            y[i] += value * x[j];
+            y_abs[i] += fabs(value) * x_abs[j];
+        }
+    }
+}
+
+// Uniform in [-1, 1], the same on every call and every MPI rank
+void verify_vector(int n, double *x, double *x_abs) {
+    unsigned long state = 54321;
+    for (int j = 0; j < n; j++) {
+        state = state * 6364136223846793005UL + 1442695040888963407UL;
+        x[j] = (double)(state >> 11) * ldexp(1.0, -52) - 1.0;
+        x_abs[j] = fabs(x[j]);
+    }
+}
+
+double verify_tolerance(int precision, int k, int n) {
+    return VERIFY_SAFETY * ((k + 2) * accumulation_unit(precision) + (k + n) * ldexp(1.0, -53));
+}
+
+// Largest |y - w|_i / w_abs_i, NaN as soon as one of the rows is
+double verify_residual(int rows, const double *y, const double *w, const double *w_abs) {
+    double residual = 0.0;
+    for (int i = 0; i < rows; i++) {
+        double difference = fabs(y[i] - w[i]);
+        double ratio = w_abs[i] > 0.0 ? difference / w_abs[i] : (difference > 0.0 ? INFINITY : 0.0);
+        if (isnan(ratio)) {
+            return ratio;
+        }
+        if (ratio > residual) {
+            residual = ratio;
+        }
+    }
+    return residual;
+}
+
+void freivalds_check(int precision, int m, int k, int n, const void *A, const void *B, const void *C, struct verify_result *result) {
+    double *x = malloc((2 * (size_t)n + 2 * (size_t)k + 4 * (size_t)m) * sizeof(double));
+    double *x_abs = x + n, *z = x_abs + n, *z_abs = z + k;
+    double *w = z_abs + k, *w_abs = w + m, *y = w_abs + m, *y_abs = y + m;
+
+    result->tolerance = verify_tolerance(precision, k, n);
+    if (x == NULL) {
+        fprintf(stderr, " Unable to allocate the verification vectors\n");
+        result->residual = NAN;
+        result->passed = 0;
+        return;
+    }
+
+    verify_vector(n, x, x_abs);
+    verify_gemv(precision, 0, k, n, B, x, x_abs, z, z_abs);
+    verify_gemv(precision, 0, m, k, A, z, z_abs, w, w_abs);
+    verify_gemv(precision, 1, m, n, C, x, x_abs, y, y_abs);
+
+    result->residual = verify_residual(m, y, w, w_abs);
+    result->passed = result->residual <= result->tolerance;
+    free(x);
+}